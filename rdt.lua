@@ -0,0 +1,179 @@
+-- Wireshark dissector for the rdt_message packet format (see rdt_utils.h).
+--
+-- rdt_sim -p writes the packets crossing the simulated link into a pcapng
+-- file with link type USER0.  Load this file with
+--     wireshark -X lua_script:rdt.lua capture.pcapng
+-- Direction, flow number and lost/corrupted annotations are in the packet
+-- flags and comments of every record.  The direction tells data packets,
+-- sent outbound, from the replies of the receiver, sent inbound: the seq
+-- field of a reply is the advertised receive window, an ACK carries a SACK
+-- map and a NAK the list of holes it asks for ahead of its SACK map.
+
+local rdt = Proto("rdt", "Reliable Data Transport")
+
+local flag_names = { [0] = "ACK", [1] = "NAK" }
+
+local f_seq = ProtoField.uint8("rdt.seq", "Sequence number")
+local f_window = ProtoField.uint8("rdt.window", "Receive window")
+local f_ack = ProtoField.uint8("rdt.ack", "Acknowledge number")
+local f_len = ProtoField.uint8("rdt.len", "Payload length")
+local f_flags = ProtoField.uint8("rdt.flags", "Flags", base.HEX)
+local f_nak = ProtoField.bool("rdt.flags.nak", "NAK", 8, flag_names, 0x01)
+local f_ts = ProtoField.bool("rdt.flags.ts", "TS", 8, nil, 0x10)
+local f_push = ProtoField.bool("rdt.flags.push", "PUSH", 8, nil, 0x20)
+local f_syn = ProtoField.bool("rdt.flags.syn", "SYN", 8, nil, 0x40)
+local f_checksum = ProtoField.uint16("rdt.checksum", "Checksum (CRC16)", base.HEX)
+local f_payload = ProtoField.bytes("rdt.payload", "Payload")
+local f_padding = ProtoField.bytes("rdt.padding", "Padding")
+local f_tsval = ProtoField.uint32("rdt.tsval", "Timestamp (us)")
+local f_tsecr = ProtoField.uint32("rdt.tsecr", "Timestamp echo (us)")
+local f_holes = ProtoField.uint8("rdt.holes", "Holes")
+local f_hole_first = ProtoField.uint8("rdt.hole.first", "First missing")
+local f_hole_last = ProtoField.uint8("rdt.hole.last", "Last missing")
+local f_sack = ProtoField.bytes("rdt.sack", "SACK map")
+local f_sacked = ProtoField.uint8("rdt.sacked", "Held")
+local f_params = ProtoField.bytes("rdt.params", "Transport parameters")
+local f_version = ProtoField.uint8("rdt.params.version", "Version")
+local f_max_window = ProtoField.uint8("rdt.params.max_window", "Largest window")
+local f_mtu = ProtoField.uint8("rdt.params.mtu", "Payload size")
+local f_integrity = ProtoField.uint8("rdt.params.integrity", "Integrity check")
+local f_ack_freq = ProtoField.uint8("rdt.params.ack_freq", "ACK frequency")
+local f_fec = ProtoField.uint8("rdt.params.fec", "FEC scheme")
+local f_timestamps = ProtoField.uint8("rdt.params.timestamps", "Timestamps")
+
+rdt.fields = { f_seq, f_window, f_ack, f_len, f_flags, f_nak, f_ts, f_push, f_syn, f_checksum,
+    f_payload, f_padding, f_tsval, f_tsecr, f_holes, f_hole_first, f_hole_last, f_sack, f_sacked,
+    f_params, f_version, f_max_window, f_mtu, f_integrity, f_ack_freq, f_fec, f_timestamps }
+
+local HEADER_SIZE = 6
+-- the timestamp option takes the last bytes of the packet
+local TS_SIZE = 8
+local PARAMS_FIELDS = { f_version, f_max_window, f_mtu, f_integrity, f_ack_freq, f_fec, f_timestamps }
+
+-- epb_flags direction of the record, 1 inbound (a reply), 2 outbound (data)
+local ok, f_direction = pcall(Field.new, "frame.packet_flags_direction")
+if not ok then f_direction = nil end
+
+local function is_reply(pinfo, flags, len)
+    if f_direction then
+        local dir = f_direction()
+        if dir and dir.value == 1 then return true end
+        if dir and dir.value == 2 then return false end
+    end
+    if pinfo.p2p_dir == P2P_DIR_RECV then return true end
+    if pinfo.p2p_dir == P2P_DIR_SENT then return false end
+    -- no direction recorded: only NAKs and empty ACKs can be told apart
+    return bit.band(flags, 0x01) ~= 0 or len == 0
+end
+
+-- the SACK map in "range": bit i of it stands for sequence number base + i
+local function add_sack(t, range, base)
+    local st = t:add(f_sack, range)
+    local held = {}
+    for i = 0, range:len() - 1 do
+        local byte = range(i, 1):uint()
+        for b = 0, 7 do
+            if bit.band(byte, bit.lshift(1, b)) ~= 0 then
+                local seq = (base + i * 8 + b) % 256
+                st:add(f_sacked, range(i, 1), seq)
+                held[#held + 1] = seq
+            end
+        end
+    end
+    st:append_text(string.format(" (%d held)", #held))
+    return #held
+end
+
+local function add_params(t, range)
+    local pt = t:add(f_params, range)
+    for i, f in ipairs(PARAMS_FIELDS) do
+        if i > range:len() then break end
+        pt:add(f, range(i - 1, 1))
+    end
+end
+
+function rdt.dissector(buf, pinfo, tree)
+    if buf:len() < HEADER_SIZE then return 0 end
+    pinfo.cols.protocol = "RDT"
+
+    local seq = buf(0, 1):uint()
+    local ack = buf(1, 1):uint()
+    local len = buf(2, 1):uint()
+    local flags = buf(3, 1):uint()
+    local reply = is_reply(pinfo, flags, len)
+    local nak = bit.band(flags, 0x01) ~= 0
+    local syn = bit.band(flags, 0x40) ~= 0
+
+    local t = tree:add(rdt, buf(0, buf:len()))
+    t:add(reply and f_window or f_seq, buf(0, 1))
+    t:add(f_ack, buf(1, 1))
+    t:add(f_len, buf(2, 1))
+    local ft = t:add(f_flags, buf(3, 1))
+    ft:add(f_nak, buf(3, 1))
+    ft:add(f_ts, buf(3, 1))
+    ft:add(f_push, buf(3, 1))
+    ft:add(f_syn, buf(3, 1))
+    -- stored in host byte order, little endian on the machines we run on
+    t:add_le(f_checksum, buf(4, 2))
+
+    local avail = buf:len() - HEADER_SIZE
+    local has_ts = bit.band(flags, 0x10) ~= 0 and avail >= TS_SIZE
+    if has_ts then avail = avail - TS_SIZE end
+    if len > avail then
+        t:add_expert_info(PI_MALFORMED, PI_ERROR, "length exceeds packet size")
+        len = avail
+    end
+
+    local info
+    if syn then
+        if len > 0 then add_params(t, buf(HEADER_SIZE, len)) end
+        if reply then
+            info = string.format("SYN answer window=%d ack=%d", seq, ack)
+        else
+            info = string.format("SYN offer seq=%d", seq)
+        end
+    elseif not reply then
+        if len > 0 then t:add(f_payload, buf(HEADER_SIZE, len)) end
+        info = string.format("DATA seq=%d len=%d", seq, len)
+    elseif nak then
+        -- hole count, (first, last) pairs, then the SACK map from ack + 1
+        local off = 0
+        local n = 0
+        if len > 0 then
+            n = buf(HEADER_SIZE, 1):uint()
+            local ht = t:add(f_holes, buf(HEADER_SIZE, 1))
+            off = 1
+            for i = 0, n - 1 do
+                if off + 2 > len then
+                    ht:add_expert_info(PI_MALFORMED, PI_ERROR, "hole list exceeds payload")
+                    break
+                end
+                local first = buf(HEADER_SIZE + off, 1):uint()
+                local last = buf(HEADER_SIZE + off + 1, 1):uint()
+                local h = ht:add(buf(HEADER_SIZE + off, 2), string.format("Hole %d-%d", first, last))
+                h:add(f_hole_first, buf(HEADER_SIZE + off, 1))
+                h:add(f_hole_last, buf(HEADER_SIZE + off + 1, 1))
+                off = off + 2
+            end
+        end
+        local held = 0
+        if len > off then held = add_sack(t, buf(HEADER_SIZE + off, len - off), ack + 1) end
+        info = string.format("NAK ack=%d window=%d holes=%d held=%d", ack, seq, n, held)
+    else
+        -- the SACK map starts after the first packet not acknowledged
+        local held = 0
+        if len > 0 then held = add_sack(t, buf(HEADER_SIZE, len), ack + 2) end
+        info = string.format("ACK ack=%d window=%d", ack, seq)
+        if held > 0 then info = info .. string.format(" held=%d", held) end
+    end
+
+    if avail > len then t:add(f_padding, buf(HEADER_SIZE + len, avail - len)) end
+    if has_ts then
+        t:add_le(f_tsval, buf(HEADER_SIZE + avail, 4))
+        t:add_le(f_tsecr, buf(HEADER_SIZE + avail + 4, 4))
+    end
+    pinfo.cols.info = info
+    return buf:len()
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, rdt)
@@ -0,0 +1,603 @@
+/*
+ * FILE: rdt_basic_receiver.h
+ * DESCRIPTION: Reliable data transfer receiver, a template on its 
+ *              configuration (see rdt_utils.h) and its transport (see 
+ *              rdt_transport.h).
+ */
+
+#ifndef _RDT_BASIC_RECEIVER_H_
+#define _RDT_BASIC_RECEIVER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+
+#include "rdt_struct.h"
+#include "rdt_utils.h"
+#include "rdt_transport.h"
+
+// a receiver instance.  the routines are those of rdt_receiver.h, which 
+// drives one built for the simulator.
+template <class Config, class Transport>
+class basic_rdt_receiver {
+public:
+    typedef basic_rdt_message<Config> rdt_message;
+    typedef basic_rdt_params<Config> rdt_params;
+    typedef typename rdt_message::seqn_t seqn_t;
+    typedef typename Transport::packet_type packet_type;
+
+    static_assert(sizeof(rdt_message) == sizeof(packet_type),
+                  "a message fills a packet of the transport");
+
+private:
+    // shared parameters, from the configuration
+    static constexpr int SLOTS = Config::buffer_slots;
+    static constexpr seqn_t WINDOW_SIZE = Config::window_initial;
+    static constexpr seqn_t WINDOW_MAX = Config::window_max;
+    static constexpr simtick_t NAK_TIMEOUT = Config::nak_timeout;
+    // words of the reception bitmap
+    static constexpr int MAP_WORDS = SLOTS / 64;
+    // entries of the delivery queue, enough to leave the largest receive 
+    // window open while the application lags by as much again
+    static constexpr int DELIVERY_SLOTS = 2 * Config::window_max;
+    static_assert((DELIVERY_SLOTS & (DELIVERY_SLOTS - 1)) == 0,
+        "delivery queue indices wrap around");
+    // most holes a single NAK lists
+    static constexpr int NAK_MAX_HOLES = 16;
+    static_assert(1 + 2 * NAK_MAX_HOLES * sizeof(seqn_t) <= rdt_message::TS_OFFSET,
+        "the hole list of a NAK fits in before the timestamp option");
+    // most in-order packets a sender may ask to be acknowledged together
+    static constexpr uint8_t MAX_ACK_FREQ = 8;
+
+    Transport lower;
+    seqn_t window_start;
+    seqn_t received_last;
+    // packet buffers adopted from the lower layer, NULL if not received
+    seq_array<rdt_message *, SLOTS> in_buf;
+    // bit i of the map is set iff in_buf.at[i] holds a packet
+    uint64_t received[MAP_WORDS];
+    // NAK suppression: when each missing packet was last asked for, -1 if 
+    // never, and the round trip estimate spacing the requests
+    seq_array<simtick_t, SLOTS> nak_time;
+    simtick_t nak_rtt;
+    simtick_t nak_rtt_min;
+    // receive window, autotuned: packets delivered per round trip are 
+    // counted from tune_start on
+    seqn_t rcv_wnd;
+    simtick_t tune_start;
+    int tune_delivered;
+    // parameters agreed in the handshake, and in-order packets not 
+    // acknowledged yet because of the ACK frequency
+    rdt_params params;
+    int unacked;
+    // tsval of the first of those, echoed by the delayed ACK
+    uint32_t ts_echo;
+    // window in the last reply
+    seqn_t adv_wnd;
+    // delivery queue, see SetDeliveryQueue(): buffers of delivered packets
+    // from reclaimed up to head, those up to tail taken already.  head is 
+    // written by the thread driving the instance, tail by the application,
+    // each on its own cache line
+    bool queued = false;
+    rdt_message *delivery[DELIVERY_SLOTS];
+    uint32_t reclaimed;
+    alignas(64) std::atomic<uint32_t> delivery_head{0};
+    alignas(64) std::atomic<uint32_t> delivery_tail{0};
+    // a reply advertised a window the queue held down
+    std::atomic<bool> update_wanted{false};
+
+public:
+    explicit basic_rdt_receiver(const Transport &lower = Transport()):
+        lower(lower), in_buf(), received(), delivery()
+    {
+        nak_time.fill(-1);
+    }
+
+    basic_rdt_receiver(const basic_rdt_receiver &) = delete;
+    basic_rdt_receiver &operator=(const basic_rdt_receiver &) = delete;
+
+    ~basic_rdt_receiver()
+    {
+        for (int i = 0; i < SLOTS; i++)
+            if (in_buf[i]) lower.release((packet_type *)in_buf[i]);
+        uint32_t head = delivery_head.load();
+        for (uint32_t i = reclaimed; i != head; i++)
+            lower.release((packet_type *)delivery[i % DELIVERY_SLOTS]);
+    }
+
+    // see Receiver_SetDeliveryQueue()
+    void SetDeliveryQueue(bool on)
+    {
+        queued = on;
+    }
+
+private:
+    /*
+     * Reception bitmap
+     */
+
+    void Map_Set(seqn_t seq)
+    {
+        unsigned i = seq & (SLOTS - 1);
+        received[i >> 6] |= 1ULL << (i & 63);
+    }
+
+    void Map_Clear(seqn_t seq)
+    {
+        unsigned i = seq & (SLOTS - 1);
+        received[i >> 6] &= ~(1ULL << (i & 63));
+    }
+
+    // 64 bits of the map starting at sequence number "from", wrapping around
+    uint64_t Map_Bits(seqn_t from)
+    {
+        int idx = (from & (SLOTS - 1)) >> 6, off = from & 63;
+        uint64_t bits = received[idx] >> off;
+        if (off)
+            bits |= received[(idx + 1) % MAP_WORDS] << (64 - off);
+        return bits;
+    }
+
+    // number of consecutive packets held from "from" on, i.e. the distance to
+    // the next hole
+    int Map_Run(seqn_t from)
+    {
+        int run = 0;
+        while (run < SLOTS) {
+            uint64_t holes = ~Map_Bits(add(from, run));
+            int n = holes ? __builtin_ctzll(holes) : 64;
+            run += n;
+            if (n < 64) break;
+        }
+        return run > SLOTS ? SLOTS : run;
+    }
+
+    // write the SACK map of the packets held after the window start into 
+    // "sack": bit i is set iff window_start + 1 + i was received.  returns the 
+    // number of bytes written, enough to reach received_last.
+    int Map_Sack(uint8_t *sack, int max_bytes)
+    {
+        if (!lt(window_start, received_last)) return 0;
+        int nbits = minus(received_last, window_start);
+        int nbytes = (nbits + 7) / 8;
+        if (nbytes > max_bytes) nbytes = max_bytes;
+        for (int i = 0; i < nbytes; i += 8) {
+            uint64_t bits = Map_Bits(add(window_start, 1 + i * 8));
+            memcpy(sack + i, &bits, nbytes - i < 8 ? nbytes - i : 8);
+        }
+        // drop the bits past received_last, unless the map was cut short
+        // before it and they are all valid
+        if (nbits % 8 && nbytes == (nbits + 7) / 8)
+            sack[nbytes - 1] &= (1 << (nbits % 8)) - 1;
+        return nbytes;
+    }
+
+public:
+    /* receiver initialization, called once at the very beginning */
+    void Init()
+    {
+        RECEIVER_INFO("Initializing...");
+        window_start = 0;
+        received_last = 0;
+        nak_time.fill(-1);
+        nak_rtt = NAK_TIMEOUT;
+        nak_rtt_min = NAK_TIMEOUT;
+        rcv_wnd = WINDOW_SIZE;
+        tune_start = 0;
+        tune_delivered = 0;
+        params = default_params<Config>();
+        unacked = 0;
+        ts_echo = 0;
+        adv_wnd = rcv_wnd;
+        reclaimed = 0;
+        delivery_head.store(0);
+        delivery_tail.store(0);
+        update_wanted.store(false);
+    }
+
+    /* receiver finalization, called once at the very end.
+       you may find that you don't need it, in which case you can leave it blank.
+       in certain cases, you might want to use this opportunity to release some 
+       memory you allocated in Init(). */
+    void Final()
+    {
+        RECEIVER_INFO("Finalizing...");
+    }
+
+    /* write the state of the receiver to a snapshot, only the buffers held in 
+       in_buf are saved */
+    bool Save(FILE *fp)
+    {
+        bool ok = snap_write(fp, window_start) && snap_write(fp, received_last) &&
+            snap_write(fp, nak_time) && snap_write(fp, nak_rtt) &&
+            snap_write(fp, nak_rtt_min) &&
+            snap_write(fp, rcv_wnd) && snap_write(fp, tune_start) &&
+            snap_write(fp, tune_delivered) && snap_write(fp, params) &&
+            snap_write(fp, unacked) && snap_write(fp, ts_echo);
+        uint16_t n = 0;
+        for (int i = 0; i < SLOTS; i++)
+            if (in_buf[i]) n++;
+        ok = ok && snap_write(fp, n);
+        for (int i = 0; ok && i < SLOTS; i++)
+            if (in_buf[i])
+                ok = snap_write(fp, *in_buf[i]);
+        return ok;
+    }
+
+    /* restore the receiver from a snapshot, this replaces Init() */
+    bool Restore(FILE *fp)
+    {
+        for (int i = 0; i < SLOTS; i++) {
+            if (in_buf[i]) lower.release((packet_type *)in_buf[i]);
+            in_buf[i] = nullptr;
+        }
+        memset(received, 0, sizeof(received));
+        bool ok = snap_read(fp, window_start) && snap_read(fp, received_last) &&
+            snap_read(fp, nak_time) && snap_read(fp, nak_rtt) &&
+            snap_read(fp, nak_rtt_min) &&
+            snap_read(fp, rcv_wnd) && snap_read(fp, tune_start) &&
+            snap_read(fp, tune_delivered) && snap_read(fp, params) &&
+            snap_read(fp, unacked) && snap_read(fp, ts_echo);
+        uint16_t n = 0;
+        ok = ok && snap_read(fp, n);
+        for (int i = 0; ok && i < n; i++) {
+            rdt_message *m = (rdt_message *)lower.acquire();
+            ok = snap_read(fp, *m);
+            if (ok && !in_buf[m->seq]) {
+                in_buf[m->seq] = m;
+                Map_Set(m->seq);
+            } else {
+                lower.release((packet_type *)m);
+            }
+        }
+        return ok;
+    }
+
+    /*
+     * Delivery queue
+     *
+     * With the queue on, packets delivered in order are not handed to the upper
+     * layer from within FromLowerLayer(): their buffers go into a 
+     * single-producer single-consumer ring the application takes them from on its
+     * own thread, so a slow consumer never holds up the replies.  The buffers 
+     * come back to the lower layer on the thread driving the instance once 
+     * taken.  The receive window is cut to the free entries of the ring, and as
+     * the left edge only moves when the ring fills, everything the sender may 
+     * send within an advertised window fits in.
+     */
+
+private:
+    // entries free for delivery, counting those taken but not reclaimed yet
+    int Delivery_Free()
+    {
+        return DELIVERY_SLOTS - (int)(delivery_head.load(std::memory_order_relaxed) - reclaimed);
+    }
+
+    void Delivery_Push(rdt_message *m)
+    {
+        uint32_t head = delivery_head.load(std::memory_order_relaxed);
+        delivery[head % DELIVERY_SLOTS] = m;
+        delivery_head.store(head + 1, std::memory_order_release);
+    }
+
+    // hand the buffers the application is done with back to the lower layer
+    int Delivery_Reclaim()
+    {
+        uint32_t tail = delivery_tail.load(std::memory_order_acquire);
+        int n = 0;
+        for (; reclaimed != tail; reclaimed++, n++)
+            lower.release((packet_type *)delivery[reclaimed % DELIVERY_SLOTS]);
+        return n;
+    }
+
+public:
+    // see Receiver_Peek() and Receiver_Consumed(), for the application thread
+    bool Peek(message *msg)
+    {
+        uint32_t tail = delivery_tail.load(std::memory_order_relaxed);
+        if (tail == delivery_head.load(std::memory_order_acquire))
+            return false;
+        rdt_message *m = delivery[tail % DELIVERY_SLOTS];
+        msg->size = m->len;
+        msg->data = m->payload;
+        return true;
+    }
+
+    bool Consumed()
+    {
+        delivery_tail.store(delivery_tail.load(std::memory_order_relaxed) + 1,
+            std::memory_order_release);
+        // pairs with the fence in Advertise(): either the receiver sees the
+        // entry taken, or we see its wish for an update
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return update_wanted.load(std::memory_order_relaxed) &&
+            update_wanted.exchange(false);
+    }
+
+    /*
+     * Receive window
+     */
+
+private:
+    // the window to advertise: without the delivery queue the whole buffer is 
+    // free again once the upper layer has taken a packet
+    seqn_t Window()
+    {
+        if (!queued) return rcv_wnd;
+        return std::min((int)rcv_wnd, Delivery_Free());
+    }
+
+    // the window for a reply, remembered to tell when it has opened enough to 
+    // be worth an update of its own
+    seqn_t Advertise()
+    {
+        adv_wnd = Window();
+        if (adv_wnd < rcv_wnd) {
+            update_wanted.store(true, std::memory_order_relaxed);
+            // entries taken before the flag was up went unannounced, take 
+            // them back now and advertise them here instead
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (Delivery_Reclaim() > 0) {
+                adv_wnd = Window();
+                if (adv_wnd == rcv_wnd)
+                    update_wanted.store(false, std::memory_order_relaxed);
+            }
+        }
+        return adv_wnd;
+    }
+
+    // count a packet handed to the upper layer.  once per round trip, the 
+    // window doubles while it is less than twice the bandwidth-delay product, 
+    // the delivery rate times the shortest round trip seen.  a window-limited
+    // sender keeps it growing until queueing stretches the round trip.
+    void Tune()
+    {
+        simtick_t now = lower.now();
+        simtick_t elapsed = now - tune_start;
+        tune_delivered++;
+        if (elapsed < nak_rtt) return;
+        if (tune_delivered * nak_rtt_min * 2 >= rcv_wnd * elapsed &&
+            rcv_wnd < params.max_window) {
+            rcv_wnd = std::min(rcv_wnd * 2, (int)params.max_window);
+            RECEIVER_INFO("Receive window grown to %d", rcv_wnd);
+        }
+        tune_start = now;
+        tune_delivered = 0;
+    }
+
+    // payload bytes a reply can carry, the timestamp option takes the end
+    int PayloadMax()
+    {
+        return params.timestamps ? rdt_message::TS_OFFSET : rdt_message::PAYLOAD_MAXSIZE;
+    }
+
+    // add the timestamp option echoing "echo" if it was agreed on
+    void Stamp(rdt_message *reply, uint32_t echo)
+    {
+        if (params.timestamps)
+            reply->set_timestamps(to_timestamp(lower.now()), echo);
+    }
+
+    // send back an ACK or NAK for ack number "ack", the payload carries the SACK
+    // map of the packets held beyond the window start
+    void Reply(uint8_t flags, seqn_t ack, uint32_t echo)
+    {
+        rdt_message *reply = (rdt_message *)lower.acquire();
+        reply->seq = Advertise();
+        reply->ack = ack;
+        reply->flags = flags;
+        reply->len = Map_Sack((uint8_t *)reply->payload, PayloadMax());
+        Stamp(reply, echo);
+        reply->fill_checksum();
+        unacked = 0;
+        lower.receiver_send_buffer((packet_type *)reply);
+    }
+
+public:
+    // with the delivery queue on, reclaim the buffers the application is done 
+    // with.  a window held down in the last reply that has since at least doubled
+    // (or fully opened) is announced in an ACK without timestamp, its echo 
+    // would be stale.
+    int Reclaim()
+    {
+        if (!queued) return 0;
+        int n = Delivery_Reclaim();
+        seqn_t window = Window();
+        if (window > adv_wnd && window >= std::min(2 * adv_wnd + 1, (int)rcv_wnd)) {
+            rdt_message *reply = (rdt_message *)lower.acquire();
+            reply->seq = Advertise();
+            reply->ack = minus(window_start, 1);
+            reply->flags = rdt_message::ACK;
+            reply->len = Map_Sack((uint8_t *)reply->payload, PayloadMax());
+            reply->fill_checksum();
+            // it acknowledges the packets the delayed ACK holds back as well
+            unacked = 0;
+            RECEIVER_INFO("<-- window update = %d", adv_wnd);
+            lower.receiver_send_buffer((packet_type *)reply);
+        }
+        return n;
+    }
+
+private:
+    // ask for the holes between the window start and the last received packet
+    // that haven't been asked for within the round trip estimate.  returns 
+    // false if all of them were, no NAK is sent then.
+    bool Nak(uint32_t echo)
+    {
+        rdt_message *reply = (rdt_message *)lower.acquire();
+        simtick_t now = lower.now();
+        int n = 0;
+
+        seqn_t pos = window_start;
+        while (lt(pos, received_last) && n < NAK_MAX_HOLES) {
+            // the set bits from pos on end the hole
+            uint64_t bits = Map_Bits(pos);
+            int len = bits ? __builtin_ctzll(bits) : 64;
+            if (len > minus(received_last, pos)) len = minus(received_last, pos);
+            seqn_t last = add(pos, len - 1);
+            if (nak_time[pos] < 0 || now - nak_time[pos] >= nak_rtt) {
+                reply->set_hole(2 * n, pos);
+                reply->set_hole(2 * n + 1, last);
+                n++;
+                for (seqn_t s = pos; ; inc(s)) {
+                    nak_time[s] = now;
+                    if (s == last) break;
+                }
+            }
+            pos = add(pos, len);
+            pos = add(pos, Map_Run(pos));
+        }
+        if (n == 0) {
+            lower.release((packet_type *)reply);
+            return false;
+        }
+
+        reply->payload[0] = n;
+        int off = 1 + 2 * n * sizeof(seqn_t);
+        reply->seq = Advertise();
+        reply->ack = window_start;
+        reply->flags = rdt_message::NAK;
+        reply->len = off + Map_Sack((uint8_t *)reply->payload + off, PayloadMax() - off);
+        Stamp(reply, echo);
+        reply->fill_checksum();
+        unacked = 0;
+        RECEIVER_INFO("<-- nak = %d, %d hole(s)", window_start, n);
+        lower.receiver_send_buffer((packet_type *)reply);
+        return true;
+    }
+
+    // answer the sender's offer with the parameters we agree to.  a repeated 
+    // SYN gets the same answer again.
+    void Accept(const rdt_message *syn)
+    {
+        rdt_params offer = default_params<Config>(), limits = default_params<Config>();
+        memcpy(&offer, syn->payload, std::min((int)syn->len, (int)sizeof(rdt_params)));
+        limits.ack_freq = MAX_ACK_FREQ;
+        limits.timestamps = 1;
+        params = negotiate(offer, limits);
+        if (!(syn->flags & rdt_message::TS))
+            params.timestamps = 0;
+        rcv_wnd = std::min(rcv_wnd, params.max_window);
+        RECEIVER_INFO("->o syn, window = %d, mtu = %d, ack every %d",
+            params.max_window, params.mtu, params.ack_freq);
+
+        rdt_message *reply = (rdt_message *)lower.acquire();
+        reply->seq = Advertise();
+        reply->ack = minus(window_start, 1);
+        reply->flags = rdt_message::SYN;
+        reply->len = sizeof(rdt_params);
+        memcpy(reply->payload, &params, sizeof(rdt_params));
+        Stamp(reply, syn->ts_val());
+        reply->fill_checksum();
+        lower.receiver_send_buffer((packet_type *)reply);
+    }
+
+public:
+    /* event handler, called when a packet is passed from the lower layer at the 
+       receiver */
+    void FromLowerLayer(const packet_type *pkt)
+    {
+        packet_type *buf = lower.acquire();
+        memcpy(buf, pkt, sizeof(packet_type));
+        AdoptFromLowerLayer(buf);
+    }
+
+    /* event handler, called when a packet buffer is handed over from the lower 
+       layer at the receiver.  buffers within the window are kept as they are in
+       in_buf until delivered, everything else is released right away. */
+    void AdoptFromLowerLayer(packet_type *pkt)
+    {
+        rdt_message *rdtmsg = (rdt_message *)pkt;
+
+        // check packet
+        if(!rdtmsg->check()) {
+            RECEIVER_INFO("->x packet corrupted, seq = %d?", rdtmsg->seq);
+            lower.release(pkt);
+            return;
+        } else {
+            RECEIVER_INFO("->o seq = %d, window = %d", rdtmsg->seq, window_start);
+        }
+        if(rdtmsg->flags & rdt_message::SYN) {
+            Accept(rdtmsg);
+            lower.release(pkt);
+            return;
+        }
+        if(queued)
+            Delivery_Reclaim();
+        // the buffer may be delivered and released below
+        bool push = rdtmsg->flags & rdt_message::PUSH;
+        uint32_t echo = rdtmsg->ts_val();
+
+        // if this packet's sequence number is within our range
+        if(!lt(rdtmsg->seq, window_start) &&
+           lt(rdtmsg->seq, add(window_start, Window()))) {
+            // update the lastest received packet number
+            if(lt(received_last, rdtmsg->seq))
+                received_last = rdtmsg->seq;
+            // adopt the buffer, dropping a duplicate we might hold already
+            rdt_message *&slot = in_buf[rdtmsg->seq];
+            if(slot) lower.release((packet_type *)slot);
+            slot = rdtmsg;
+            Map_Set(rdtmsg->seq);
+            // a hole we asked for got filled, the time it took estimates the 
+            // round trip
+            simtick_t &asked = nak_time[rdtmsg->seq];
+            if(asked >= 0) {
+                // a much quicker fill is a reordered original rather than a
+                // round trip, it doesn't count for the minimum
+                simtick_t rtt = lower.now() - asked;
+                if(rtt < nak_rtt_min && rtt >= nak_rtt / 2)
+                    nak_rtt_min = rtt;
+                nak_rtt += (rtt - nak_rtt) / 8;
+                asked = -1;
+            }
+
+            // send the run up to the next hole to upper layer
+            int delivered = Map_Run(window_start);
+            if(queued)
+                delivered = std::min(delivered, Delivery_Free());
+            for(int run = delivered; run > 0; run--) {
+                rdt_message *m = in_buf[window_start];
+                if(queued) {
+                    // the application takes it, the buffer comes back later
+                    Delivery_Push(m);
+                } else {
+                    message msg = message{int(m->len), m->payload};
+                    lower.deliver(&msg);
+                    // hand the buffer back
+                    lower.release((packet_type *)m);
+                }
+                Tune();
+                in_buf[window_start] = nullptr;
+                Map_Clear(window_start);
+                inc(window_start);
+            }
+
+            // the next frame has yet not been received, send nak
+            // we don't have timer on receiver side, so we ask again for a hole
+            // once per round trip as packets keep coming, and ack in between
+            if(lt(window_start, received_last) && Nak(echo))
+                return;
+            // a packet that just extends the in-order run is acknowledged along
+            // with the next ones, as the ACK frequency allows
+            if(delivered == 1 && !push) {
+                if(unacked++ == 0)
+                    ts_echo = echo;
+                if(unacked < params.ack_freq)
+                    return;
+                echo = ts_echo;
+            }
+        } else {
+            RECEIVER_WARNING("Packet seq outside the window, not saved.");
+            lower.release(pkt);
+        }
+        // send back ack
+        seqn_t ack = minus(window_start, 1);
+        RECEIVER_INFO("<-- ack = %d", ack);
+        Reply(rdt_message::ACK, ack, echo);
+    }
+};
+
+#endif  /* _RDT_BASIC_RECEIVER_H_ */
@@ -0,0 +1,956 @@
+/*
+ * FILE: rdt_basic_sender.h
+ * DESCRIPTION: Reliable data transfer sender, a template on its 
+ *              configuration (see rdt_utils.h) and its transport (see 
+ *              rdt_transport.h).
+ */
+
+#ifndef _RDT_BASIC_SENDER_H_
+#define _RDT_BASIC_SENDER_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <atomic>
+#include <algorithm>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_utils.h"
+#include "rdt_transport.h"
+
+/*
+ * Timer queue implementation
+ */
+
+struct TimerItem {
+    int id;
+    simtick_t time;
+    TimerItem *prev, *next;
+};
+
+// submission queue nodes, preallocated per sender, each holding up to
+// SUBMIT_CHUNK bytes of a message passed in by Submit()
+const int SUBMIT_NODES = 256;
+const int SUBMIT_CHUNK = 248;
+
+struct Submission {
+    std::atomic<uint32_t> next;     // node number + 1, 0 ends the chain
+    uint16_t size;
+    bool last;                      // the last chunk of its message
+    char data[SUBMIT_CHUNK];
+};
+
+// reordering window of the loss detection, in quarters of srtt
+const int RACK_REORDER_MIN = 2;
+const int RACK_REORDER_MAX = 8;
+// slot flag: last resent because the loss detection declared it lost
+const uint8_t RACK_LOST = 16;
+
+// a sender instance.  the routines are those of rdt_sender.h, which drives
+// one built for the simulator.
+template <class Config, class Transport>
+class basic_rdt_sender {
+public:
+    typedef basic_rdt_message<Config> rdt_message;
+    typedef basic_rdt_params<Config> rdt_params;
+    typedef typename rdt_message::seqn_t seqn_t;
+    typedef typename rdt_message::len_type len_type;
+    typedef typename Transport::packet_type packet_type;
+
+    static_assert(sizeof(rdt_message) == sizeof(packet_type),
+                  "a message fills a packet of the transport");
+
+private:
+    // shared parameters, from the configuration
+    static constexpr int SLOTS = Config::buffer_slots;
+    static constexpr int MAX_SEQ = std::numeric_limits<seqn_t>::max();
+    static constexpr seqn_t WINDOW_SIZE = Config::window_initial;
+    static constexpr seqn_t WINDOW_MAX = Config::window_max;
+    static constexpr simtick_t SENDER_TIMEOUT = Config::sender_timeout;
+    static constexpr simtick_t NAK_TIMEOUT = Config::nak_timeout;
+
+    Transport lower;
+    // packet ring buffer, only the wire image of each slot
+    seq_array<rdt_message, SLOTS> out_buf;
+    // control state of the ring buffer slots, kept in dense arrays apart from
+    // the payload so window scans don't pull a whole packet per slot
+    seq_array<uint8_t, SLOTS> slot_flags;       // sender-side flags, e.g. NAKING
+    seq_array<len_type, SLOTS> slot_len;        // payload bytes filled so far
+    seq_array<simtick_t, SLOTS> slot_first;     // time of the first transmission
+    seq_array<simtick_t, SLOTS> slot_sent;      // time of the last transmission
+    seq_array<uint8_t, SLOTS> slot_retx;        // number of retransmissions
+    seq_array<TimerItem *, SLOTS> slot_timer;   // pending timeout, if any
+    std::queue<rdt_message> external_buffer;
+    // parameters
+    seqn_t window_start;
+    seqn_t next_seq_number;
+    seqn_t to_send;
+    seqn_t peer_window;     // receive window advertised by the receiver
+    // handshake: the parameters offered, and those agreed once established
+    rdt_params offer = default_params<Config>();
+    rdt_params params;
+    bool established;
+    bool syn_sent;
+    // timer queue, behind a dummy head
+    TimerItem timers = {-1, 0, nullptr, nullptr};
+    // single retransmission timer mode: one timer for the whole window 
+    // instead of the timer queue, -1 when not armed
+    bool single_timer = false;
+    simtick_t rto_deadline = -1;
+    // time-based loss detection, see Rack_DetectLoss()
+    bool rack = false;
+    simtick_t srtt;         // smoothed round trip time, 0 before any sample
+    simtick_t rack_sent;    // send time of the latest sent delivered packet,
+    seqn_t rack_seq;        // its sequence number,
+    simtick_t rack_rtt;     // and its round trip time
+    int reo_quarters;       // reordering window in quarters of srtt
+    // shortest round trip seen, 0 before any sample, see Delivered()
+    simtick_t rtt_min;
+    simtick_t rttvar;       // mean deviation of the round trip time
+    // timestamp echoed by the reply being processed, if it has one
+    bool echo_valid;
+    uint32_t echo;
+    sender_stats stats;
+    // the members other threads touch, each on its own cache line:
+    // chunks from Submit() not drained yet, the newest first, as node
+    // number + 1
+    alignas(64) std::atomic<uint32_t> submitted{0};
+    // free nodes, a stack with the node number + 1 in the low half and a
+    // count of its changes in the high half, so a pop that raced with a 
+    // pop and push of the same node fails
+    alignas(64) std::atomic<uint64_t> free_nodes;
+    alignas(64) Submission nodes[SUBMIT_NODES];
+
+    // free all items of the timer queue
+    void Timer_Clear() {
+        TimerItem *cur = timers.next;
+        while(cur) {
+            TimerItem *next = cur->next;
+            delete cur;
+            cur = next;
+        }
+        timers.next = nullptr;
+        slot_timer.fill(nullptr);
+    }
+
+    // take a free node, 0 if none is left
+    uint32_t Node_Get() {
+        uint64_t head = free_nodes.load(std::memory_order_acquire);
+        for(;;) {
+            uint32_t n = (uint32_t)head;
+            if(n == 0) return 0;
+            uint64_t next = nodes[n - 1].next.load(std::memory_order_relaxed);
+            if(free_nodes.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | next,
+                        std::memory_order_acquire, std::memory_order_acquire))
+                return n;
+        }
+    }
+
+    // give back the chain of nodes from "first" to "last"
+    void Node_Put(uint32_t first, uint32_t last) {
+        uint64_t head = free_nodes.load(std::memory_order_relaxed);
+        do {
+            nodes[last - 1].next.store((uint32_t)head, std::memory_order_relaxed);
+        } while(!free_nodes.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | first,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+public:
+    explicit basic_rdt_sender(const Transport &lower = Transport()):
+        lower(lower), out_buf(), slot_flags(), slot_len(), slot_first(),
+        slot_sent(), slot_retx(), slot_timer() {
+        for(int i = 0; i < SUBMIT_NODES; i++)
+            nodes[i].next.store(i + 1 < SUBMIT_NODES ? i + 2 : 0, std::memory_order_relaxed);
+        free_nodes.store(1, std::memory_order_relaxed);
+    }
+
+    basic_rdt_sender(const basic_rdt_sender &) = delete;
+    basic_rdt_sender &operator=(const basic_rdt_sender &) = delete;
+
+    ~basic_rdt_sender() {
+        Timer_Clear();
+    }
+
+    void SetSingleTimer(bool on) {
+        single_timer = on;
+    }
+
+    void SetLossDetection(bool on) {
+        rack = on;
+    }
+
+    bool Idle() {
+        // submitted but not drained yet
+        if(submitted.load(std::memory_order_acquire) != 0) return false;
+        if(!syn_sent) return true;
+        // nothing outstanding, nothing unsent but possibly an empty slot to fill
+        return established && window_start == to_send &&
+            external_buffer.empty() && (to_send == next_seq_number ||
+            (add(to_send, 1) == next_seq_number && slot_len[to_send] == 0));
+    }
+
+    // packets taken from the upper layer but not sent yet, those beyond the
+    // window included, for a caller to hold its input back by
+    size_t Pending() {
+        return external_buffer.size() + minus(next_seq_number, to_send);
+    }
+
+    void GetStats(sender_stats *out) {
+        *out = stats;
+    }
+
+    void SetOffer(int max_window, int mtu, int ack_freq, bool timestamps) {
+        offer = default_params<Config>();
+        offer.timestamps = timestamps;
+        if(timestamps)
+            offer.mtu = rdt_message::TS_OFFSET;
+        if(max_window > 0)
+            offer.max_window = std::min(max_window, (int)WINDOW_MAX);
+        if(mtu > 0)
+            offer.mtu = std::min(mtu, (int)offer.mtu);
+        if(ack_freq > 0)
+            offer.ack_freq = std::min(ack_freq, 255);
+    }
+
+private:
+    // fold a round trip time sample into the estimates
+    void RttSample(simtick_t rtt) {
+        if(srtt == 0) {
+            srtt = rtt;
+            rttvar = rtt / 2;
+        } else {
+            rttvar += (std::abs(srtt - rtt) - rttvar) / 4;
+            srtt += (rtt - srtt) / 8;
+        }
+        if(rtt_min == 0 || rtt < rtt_min)
+            rtt_min = rtt;
+    }
+
+    /*
+     * Handshake
+     */
+
+    // offer our parameters, again every SENDER_TIMEOUT until answered
+    void SendSyn() {
+        rdt_message *syn = (rdt_message *)lower.acquire();
+        syn->seq = 0;
+        syn->ack = 0;
+        syn->flags = rdt_message::SYN;
+        syn->len = sizeof(rdt_params);
+        memcpy(syn->payload, &offer, sizeof(rdt_params));
+        if(offer.timestamps)
+            syn->set_timestamps(to_timestamp(lower.now()), 0);
+        syn->fill_checksum();
+        SENDER_INFO("--> syn, window = %d, mtu = %d, ack every %d",
+            offer.max_window, offer.mtu, offer.ack_freq);
+        lower.sender_send_buffer((packet_type *)syn);
+        syn_sent = true;
+        if(lower.timer_set())
+            lower.stop_timer();
+        lower.start_timer(SENDER_TIMEOUT);
+    }
+
+    // the receiver answered with the agreed parameters
+    void Established(const rdt_message *syn) {
+        if(established || syn->len < sizeof(rdt_params)) return;
+        memcpy(&params, syn->payload, sizeof(rdt_params));
+        established = true;
+        if(params.timestamps && (syn->flags & rdt_message::TS))
+            RttSample(ts_diff(to_timestamp(lower.now()), syn->ts_ecr()));
+        lower.stop_timer();
+        SENDER_INFO("o<- syn, window = %d, mtu = %d, ack every %d",
+            params.max_window, params.mtu, params.ack_freq);
+    }
+
+    // add timeout item into timer queue
+    void Timer_AddTimeout(int id, simtick_t timeout) {
+        TimerItem *prehead = &timers;
+        TimerItem *cur = prehead;
+        simtick_t dest = lower.now() + timeout;
+        while(cur->next && cur->next->time < dest) cur = cur->next;
+        TimerItem *new_item = new TimerItem{id, dest, cur, cur->next};
+        if(cur->next) cur->next->prev = new_item;
+        cur->next = new_item;
+        slot_timer[id] = new_item;
+        if(cur == prehead) {
+            // reset the timer
+            if(lower.timer_set())
+                lower.stop_timer();
+            lower.start_timer(dest - lower.now());
+        }
+    }
+
+    // remove timeout item from timer queue
+    // every slot has at most one pending timeout, found through its timer link
+    void Timer_CancelTimeout(int id) {
+        TimerItem *prehead = &timers;
+        TimerItem *target = slot_timer[id];
+        if(target == nullptr) {
+            SENDER_ERROR("%d not found in timer queue.", id);
+            return;
+        }
+        // remove this entry from linked list
+        TimerItem *cur = target->prev;
+        cur->next = target->next;
+        if(target->next) target->next->prev = cur;
+        slot_timer[id] = nullptr;
+        delete target;
+        if(cur == prehead) {
+            // stop timer
+            lower.stop_timer();
+            if(prehead->next != nullptr)
+                lower.start_timer(prehead->next->time - lower.now());
+        }
+    }
+
+    // remove the timeout items of all slots from "first" through "last" in one 
+    // pass, the system timer is re-armed at most once
+    void Timer_CancelRange(seqn_t first, seqn_t last) {
+        TimerItem *prehead = &timers;
+        TimerItem *head = prehead->next;
+        for(seqn_t id = first; ; inc(id)) {
+            TimerItem *target = slot_timer[id];
+            if(target) {
+                target->prev->next = target->next;
+                if(target->next) target->next->prev = target->prev;
+                slot_timer[id] = nullptr;
+                delete target;
+            }
+            if(id == last) break;
+        }
+        if(prehead->next != head) {
+            lower.stop_timer();
+            if(prehead->next != nullptr)
+                lower.start_timer(prehead->next->time - lower.now());
+        }
+    }
+
+    // put slot "id" on the link again.  the receiver answers a retransmission
+    // right away, with the timestamp of this copy if the option is on.
+    void Resend(seqn_t id) {
+        rdt_message *buffer = &out_buf[id];
+        slot_sent[id] = lower.now();
+        slot_retx[id]++;
+        stats.retransmitted++;
+        stats.retx_bytes += slot_len[id];
+        buffer->flags |= rdt_message::PUSH;
+        if(params.timestamps)
+            buffer->set_timestamps(to_timestamp(slot_sent[id]), 0);
+        buffer->fill_checksum();
+        lower.sender_send((packet_type *)buffer);
+    }
+
+    // slot "id" is acknowledged for the first time.  without timestamps replies
+    // don't tell which transmission they answer, so only never retransmitted 
+    // packets give RTT samples, and a retransmitted packet acknowledged sooner 
+    // than the shortest round trip after its last transmission was delivered by
+    // an earlier copy.  with timestamps, the echo tells it for sure: it is older
+    // than the last transmission.  that retransmission was spurious.
+    void Delivered(seqn_t id) {
+        simtick_t now = lower.now();
+        simtick_t since = now - slot_sent[id];
+        slot_flags[id] |= rdt_message::ACKED;
+        stats.acked++;
+        stats.ack_delay += now - slot_first[id];
+        bool spurious;
+        if(params.timestamps) {
+            spurious = slot_retx[id] != 0 && echo_valid &&
+                ts_diff(echo, to_timestamp(slot_sent[id])) < 0;
+        } else if(slot_retx[id] == 0) {
+            RttSample(since);
+            spurious = false;
+        } else {
+            spurious = since < rtt_min;
+        }
+        if(spurious) {
+            SENDER_INFO("Retransmission of seq = %d was spurious", id);
+            stats.spurious++;
+            stats.spurious_bytes += slot_len[id];
+            // a timeout this early means the deviation was underestimated
+            if(params.timestamps)
+                rttvar += srtt / 4;
+        }
+    }
+
+    // retransmission timeout, from the RTT samples if timestamps give one with
+    // every reply, a fixed one otherwise
+    simtick_t Rto() {
+        if(!params.timestamps || srtt == 0)
+            return SENDER_TIMEOUT;
+        return std::clamp(srtt + 4 * rttvar, NAK_TIMEOUT, SENDER_TIMEOUT);
+    }
+
+    /*
+     * Single retransmission timer
+     *
+     * One timer covers the oldest outstanding packet and restarts on forward
+     * progress.  When it fires, every outstanding packet sent at least
+     * the retransmission timeout ago is resent, the send times tell which ones.
+     */
+
+    // (re)arm the retransmission timer for "deadline", -1 stops it
+    void Rto_Arm(simtick_t deadline) {
+        if(lower.timer_set())
+            lower.stop_timer();
+        rto_deadline = deadline;
+        if(deadline >= 0)
+            lower.start_timer(deadline - lower.now());
+    }
+
+    void Rto_Timeout() {
+        simtick_t now = lower.now();
+        simtick_t rto = Rto();
+        simtick_t oldest = -1;
+        rto_deadline = -1;
+        for(seqn_t id = window_start; id != to_send; inc(id)) {
+            if(slot_flags[id] & rdt_message::ACKED) continue;
+            if(slot_sent[id] + rto <= now) {
+                SENDER_INFO("Packet timeout, resending packet seq = %d", id);
+                slot_flags[id] &= ~RACK_LOST;
+                Resend(id);
+            }
+            if(oldest < 0 || slot_sent[id] < oldest)
+                oldest = slot_sent[id];
+        }
+        if(oldest >= 0)
+            Rto_Arm(oldest + rto);
+    }
+
+public:
+    // system timer event handler
+    void Timeout()
+    {
+        if(!established) {
+            SendSyn();
+            return;
+        }
+        if(single_timer) {
+            Rto_Timeout();
+            return;
+        }
+        TimerItem *prehead = &timers;
+        if(prehead->next == nullptr) {
+            SENDER_ERROR("Clock time out and timer queue is empty.");
+            return;
+        }
+        while(prehead->next && lower.now() >= prehead->next->time) {
+            auto item = prehead->next;
+            prehead->next = item->next;
+            if(item->next) item->next->prev = prehead;
+            int id = item->id;
+            slot_timer[id] = nullptr;
+            delete item;
+            Timer_Timeout(id);
+        } 
+        // restart timer for next event
+        if(prehead->next)
+            lower.start_timer(prehead->next->time - lower.now());
+    }
+
+private:
+    // timeout handler
+    void Timer_Timeout(int id) {
+        // there're two types of timeout, ACK timeout and NAK timeout
+        // we need to resend that packet & restart timer either way
+        bool is_nak = bool(slot_flags[id] & rdt_message::NAKING);
+        SENDER_INFO("Packet timeout, resending packet seq = %d, isnak = %d",
+            out_buf[id].seq, is_nak);
+        slot_flags[id] &= ~RACK_LOST;
+        Resend(id);
+        if(is_nak) Timer_AddTimeout(id, NAK_TIMEOUT);
+        else Timer_AddTimeout(id, Rto());
+    }
+
+    // Advance sliding window
+    // Fetch buffer content from external buffer if necessary.
+    void AdvanceWindow() {
+        if(!external_buffer.empty()) {
+            out_buf[next_seq_number] = external_buffer.front();
+            external_buffer.pop();
+            out_buf[next_seq_number].seq = next_seq_number;
+            slot_len[next_seq_number] = out_buf[next_seq_number].len;
+            SENDER_INFO("Retrieving from buffer(%ld), seq=%d", external_buffer.size(), window_start);
+            inc(next_seq_number);
+        } else {
+            // invalidate buffer
+            slot_len[window_start] = 0;
+        }
+        inc(window_start);
+    }
+
+public:
+    /* sender initialization, called once at the very beginning */
+    void Init()
+    {
+        SENDER_INFO("Initializing...");
+        window_start = 0;
+        next_seq_number = 1;
+        to_send = 0;
+        peer_window = WINDOW_SIZE;
+        params = offer;
+        established = false;
+        syn_sent = false;
+        rto_deadline = -1;
+        srtt = 0;
+        rack_sent = -1;
+        rack_seq = 0;
+        rack_rtt = 0;
+        reo_quarters = RACK_REORDER_MIN;
+        rtt_min = 0;
+        rttvar = 0;
+        stats = sender_stats();
+    }
+
+    /* sender finalization, called once at the very end.
+       you may find that you don't need it, in which case you can leave it blank.
+       in certain cases, you might want to take this opportunity to release some 
+       memory you allocated in Init(). */
+    void Final()
+    {
+        SENDER_INFO("Finalizing...");
+    }
+
+    /* write the state of the sender to a snapshot.
+       only the ring buffer slots from window start up to the next sequence number
+       are in use, the rest is not saved.  timer links are rebuilt from the timer 
+       queue on restore. */
+    bool Save(FILE *fp)
+    {
+        bool ok = snap_write(fp, window_start) &&
+            snap_write(fp, next_seq_number) && snap_write(fp, to_send) &&
+            snap_write(fp, peer_window) && snap_write(fp, offer) &&
+            snap_write(fp, params) && snap_write(fp, established) &&
+            snap_write(fp, syn_sent) &&
+            snap_write(fp, single_timer) && snap_write(fp, rto_deadline) &&
+            snap_write(fp, rack) && snap_write(fp, srtt) &&
+            snap_write(fp, rack_sent) && snap_write(fp, rack_seq) &&
+            snap_write(fp, rack_rtt) && snap_write(fp, reo_quarters) &&
+            snap_write(fp, rtt_min) && snap_write(fp, rttvar) &&
+            snap_write(fp, stats);
+        for(seqn_t i = window_start; ok; inc(i)) {
+            ok = snap_write(fp, out_buf[i]) &&
+                snap_write(fp, slot_flags[i]) && snap_write(fp, slot_len[i]) &&
+                snap_write(fp, slot_first[i]) && snap_write(fp, slot_sent[i]) &&
+                snap_write(fp, slot_retx[i]);
+            if(i == next_seq_number) break;
+        }
+        // external buffer, a queue can only be walked by popping a copy
+        std::queue<rdt_message> q = external_buffer;
+        uint32_t n = q.size();
+        ok = ok && snap_write(fp, n);
+        for(; ok && !q.empty(); q.pop())
+            ok = snap_write(fp, q.front());
+        // timer queue, in order
+        n = 0;
+        for(TimerItem *cur = timers.next; cur; cur = cur->next) n++;
+        ok = ok && snap_write(fp, n);
+        for(TimerItem *cur = timers.next; ok && cur; cur = cur->next)
+            ok = snap_write(fp, cur->id) && snap_write(fp, cur->time);
+        return ok;
+    }
+
+    /* restore the sender from a snapshot, this replaces Init().
+       the simulation timer itself is restored by the caller. */
+    bool Restore(FILE *fp)
+    {
+        Timer_Clear();
+        external_buffer = std::queue<rdt_message>();
+        bool ok = snap_read(fp, window_start) &&
+            snap_read(fp, next_seq_number) && snap_read(fp, to_send) &&
+            snap_read(fp, peer_window) && snap_read(fp, offer) &&
+            snap_read(fp, params) && snap_read(fp, established) &&
+            snap_read(fp, syn_sent) &&
+            snap_read(fp, single_timer) && snap_read(fp, rto_deadline) &&
+            snap_read(fp, rack) && snap_read(fp, srtt) &&
+            snap_read(fp, rack_sent) && snap_read(fp, rack_seq) &&
+            snap_read(fp, rack_rtt) && snap_read(fp, reo_quarters) &&
+            snap_read(fp, rtt_min) && snap_read(fp, rttvar) &&
+            snap_read(fp, stats);
+        for(seqn_t i = window_start; ok; inc(i)) {
+            ok = snap_read(fp, out_buf[i]) &&
+                snap_read(fp, slot_flags[i]) && snap_read(fp, slot_len[i]) &&
+                snap_read(fp, slot_first[i]) && snap_read(fp, slot_sent[i]) &&
+                snap_read(fp, slot_retx[i]);
+            if(i == next_seq_number) break;
+        }
+        uint32_t n = 0;
+        ok = ok && snap_read(fp, n);
+        for(uint32_t i = 0; ok && i < n; i++) {
+            rdt_message m;
+            ok = snap_read(fp, m);
+            external_buffer.push(m);
+        }
+        ok = ok && snap_read(fp, n);
+        TimerItem *tail = &timers;
+        for(uint32_t i = 0; ok && i < n; i++) {
+            TimerItem *item = new TimerItem{-1, 0, tail, nullptr};
+            ok = snap_read(fp, item->id) && snap_read(fp, item->time);
+            tail->next = item;
+            tail = item;
+            if(ok && item->id >= 0 && item->id <= MAX_SEQ)
+                slot_timer[item->id] = item;
+        }
+        return ok;
+    }
+
+private:
+    // end of the sliding window the receiver lets us fill, a zero window still
+    // lets one packet through to probe it
+    seqn_t WindowEnd() {
+        seqn_t window = std::min(peer_window, params.max_window);
+        return add(window_start, std::max(window, (seqn_t)1));
+    }
+
+    // send out all packets ready to be sent in current sliding window
+    void SendPackets() {
+        if(!established) return;
+        seqn_t window_end = WindowEnd();
+        if(between(window_start, next_seq_number, window_end))
+            window_end = next_seq_number;
+        while(between(window_start, to_send, window_end)) {
+            rdt_message *buffer = &out_buf[to_send];
+            // not a duplex protocol, ack doesn't matter here
+            buffer->ack = 0;
+            // the last packet we can send for now asks for an ACK right away,
+            // the receiver may hold it back otherwise
+            buffer->flags = add(to_send, 1) == window_end ? rdt_message::PUSH : 0;
+            buffer->len = slot_len[to_send];
+            if(params.timestamps)
+                buffer->set_timestamps(to_timestamp(lower.now()), 0);
+            buffer->fill_checksum();
+            slot_flags[to_send] = 0;
+            slot_first[to_send] = slot_sent[to_send] = lower.now();
+            slot_retx[to_send] = 0;
+            stats.sent++;
+            // add timer
+            if(!single_timer)
+                Timer_AddTimeout(buffer->seq, Rto());
+            else if(rto_deadline < 0)
+                Rto_Arm(lower.now() + Rto());
+            SENDER_INFO( 
+                "--> packet seq = %03d, len = %03d, window = %03d - %03d",
+                buffer->seq, buffer->len, window_start, window_end);
+            lower.sender_send((packet_type *)buffer);
+            inc(to_send);
+        }
+    }
+
+    // pack "size" bytes into the slots after the last one, or into the external
+    // buffer queue once the ring buffer is full
+    void Append(const char *data, int size)
+    {
+        int cursor = 0; // points to the first unsent byte in the message
+        // split the message and put it into buffer
+        while (cursor < size) {
+            rdt_message *buffer;
+            len_type *len;  // fill level of the buffer
+            seqn_t before_next = minus(next_seq_number, 1);
+            // note that next_seq_number == window_start iff there's nothing more to transfer
+            if(minus(next_seq_number, window_start) == SLOTS - 1) {
+                // ring buffer is full, append to external buffer queue
+                if(external_buffer.empty() || external_buffer.back().len == params.mtu)
+                    external_buffer.emplace();
+                buffer = &(external_buffer.back());
+                len = &buffer->len;
+                SENDER_INFO("Appending to queue(%ld)", external_buffer.size());
+            } else if(between(to_send, before_next, next_seq_number) &&
+                      slot_len[before_next] < params.mtu) {
+                // not sent yet (outside the sliding window), and the last buffer 
+                // is still not full. fillout this buffer first.  the window may 
+                // shrink, only to_send tells what has gone out already
+                buffer = &out_buf[before_next];
+                len = &slot_len[before_next];
+            } else {
+                // last buffer already sent
+                // or not sent yet and full
+                // append to next buffer item
+                buffer = &out_buf[next_seq_number];
+                buffer->seq = next_seq_number;
+                len = &slot_len[next_seq_number];
+                *len = 0;
+                inc(next_seq_number);
+            }
+            // write content
+            int delta = std::min(params.mtu - *len, size - cursor);
+            memcpy(buffer->payload + *len, data + cursor, delta);
+            *len += delta;
+            cursor += delta;  // move the cursor
+        }
+        SENDER_INFO("Added new content, next sequence number = %d", next_seq_number);
+    }
+
+public:
+    /* event handler, called when a message is passed from the upper layer at the 
+       sender */
+    void FromUpperLayer(const message *msg)
+    {
+        Append(msg->data, msg->size);
+        if(!syn_sent)
+            SendSyn();
+        SendPackets();
+    }
+
+    /*
+     * Submission queue
+     *
+     * Submit() may run on any thread.  It copies the message into nodes
+     * taken from the sender's preallocated pool and pushes them on a 
+     * lock-free stack with one compare-and-swap, so producers never wait on
+     * a lock or on the protocol, and never allocate.  The thread driving the
+     * instance takes the whole stack with one exchange in Drain(), restores
+     * the order of submission, packs every message into the slots, returns 
+     * the nodes and only then sends, so a batch of small messages leaves as
+     * full packets.  A message that finds too few free nodes is refused,
+     * one larger than the whole pool always is.
+     */
+
+    int Submit(const message *msg)
+    {
+        // chunks of the message, the last one first
+        uint32_t chain = 0, tail = 0;
+        for(int cursor = 0; cursor < msg->size; cursor += SUBMIT_CHUNK) {
+            uint32_t n = Node_Get();
+            if(n == 0) {
+                if(chain) Node_Put(chain, tail);
+                return -1;
+            }
+            Submission *sub = &nodes[n - 1];
+            sub->size = std::min(msg->size - cursor, SUBMIT_CHUNK);
+            sub->last = cursor + sub->size == msg->size;
+            memcpy(sub->data, msg->data + cursor, sub->size);
+            sub->next.store(chain, std::memory_order_relaxed);
+            if(chain == 0) tail = n;
+            chain = n;
+        }
+        if(chain == 0) return 0;
+        uint32_t head = submitted.load(std::memory_order_relaxed);
+        do {
+            nodes[tail - 1].next.store(head, std::memory_order_relaxed);
+        } while(!submitted.compare_exchange_weak(head, chain,
+                    std::memory_order_release, std::memory_order_relaxed));
+        return head == 0;
+    }
+
+    int Drain()
+    {
+        uint32_t n = submitted.exchange(0, std::memory_order_acquire);
+        if(n == 0) return 0;
+        // the stack holds the newest first, reverse it
+        uint32_t fifo = 0, last = n;
+        int count = 0;
+        while(n) {
+            uint32_t next = nodes[n - 1].next.load(std::memory_order_relaxed);
+            nodes[n - 1].next.store(fifo, std::memory_order_relaxed);
+            fifo = n;
+            n = next;
+        }
+        for(n = fifo; n; n = nodes[n - 1].next.load(std::memory_order_relaxed)) {
+            Append(nodes[n - 1].data, nodes[n - 1].size);
+            count += nodes[n - 1].last;
+        }
+        Node_Put(fifo, last);
+        SENDER_INFO("Drained %d submissions", count);
+        if(!syn_sent)
+            SendSyn();
+        SendPackets();
+        return count;
+    }
+
+private:
+    // resend a packet a NAK asks for
+    // nak of the same packet may come back multiple times in a row
+    // set a timeout for it between retrying to avoid useless transfer
+    void ResendOnNak(seqn_t seq) {
+        // an older NAK overtaken by a reply that reports the packet held, or 
+        // one echoing a time before the last copy went out, which was sent 
+        // before that copy could arrive, asks for nothing new
+        if(slot_flags[seq] & rdt_message::ACKED)
+            return;
+        if(echo_valid && slot_retx[seq] != 0 &&
+           ts_diff(echo, to_timestamp(slot_sent[seq])) < 0)
+            return;
+        if(single_timer) {
+            // without per-packet timers, the send time spaces the retries
+            simtick_t now = lower.now();
+            if(!(slot_flags[seq] & rdt_message::NAKING) ||
+               now - slot_sent[seq] >= NAK_TIMEOUT) {
+                SENDER_INFO("--> Resending packet seq = %d len = %d", seq, slot_len[seq]);
+                Resend(seq);
+                slot_flags[seq] |= rdt_message::NAKING;
+            }
+        } else if(!(slot_flags[seq] & rdt_message::NAKING)) {
+            Timer_CancelTimeout(seq);
+            SENDER_INFO("--> Resending packet seq = %d len = %d", seq, slot_len[seq]);
+            Timer_AddTimeout(seq, NAK_TIMEOUT);
+            Resend(seq);
+            slot_flags[seq] |= rdt_message::NAKING;
+        }
+    }
+
+    // slide the window past everything up to "ack"
+    void Acknowledge(seqn_t ack) {
+        bool progress = lte(window_start, ack);
+        if(progress && !single_timer)
+            Timer_CancelRange(window_start, ack);
+        while(lte(window_start, ack)) {
+            if(!(slot_flags[window_start] & rdt_message::ACKED))
+                Delivered(window_start);
+            AdvanceWindow();
+        }
+        // restart the retransmission timer for what is still outstanding
+        if(progress && single_timer)
+            Rto_Arm(window_start != to_send ?
+                lower.now() + Rto() : -1);
+    }
+
+    /*
+     * Time-based loss detection (RACK)
+     *
+     * Instead of trusting NAKs, a packet counts as lost once a packet sent after 
+     * it has been delivered and a reordering window has passed on top of the 
+     * round trip time of that packet.  The window starts at half the smoothed 
+     * RTT, as the simulated link delays reordered packets by up to one extra 
+     * one-way latency, and widens by a quarter of it whenever a retransmission 
+     * turns out to be spurious.
+     */
+
+    // packet "id" got through, remember the latest sent one delivered
+    void Rack_Delivered(seqn_t id) {
+        simtick_t rtt = lower.now() - slot_sent[id];
+        Delivered(id);
+        if(slot_retx[id] != 0) {
+            // delivered sooner than any round trip after being declared lost:
+            // the original made it after all, the window was too tight
+            if((slot_flags[id] & RACK_LOST) && rtt < srtt / 2 &&
+               reo_quarters < RACK_REORDER_MAX)
+                reo_quarters++;
+            return;
+        }
+        if(slot_sent[id] > rack_sent ||
+           (slot_sent[id] == rack_sent && lt(rack_seq, id))) {
+            rack_sent = slot_sent[id];
+            rack_seq = id;
+            rack_rtt = rtt;
+        }
+    }
+
+    // resend the outstanding packets sent before the latest delivered one whose
+    // reordering window has passed
+    void Rack_DetectLoss() {
+        if(srtt == 0 || rack_sent < 0) return;
+        simtick_t now = lower.now();
+        simtick_t reo_wnd = srtt * reo_quarters / 4;
+        for(seqn_t id = window_start; id != to_send; inc(id)) {
+            if(slot_flags[id] & rdt_message::ACKED) continue;
+            bool sent_before = slot_sent[id] < rack_sent ||
+                (slot_sent[id] == rack_sent && lt(id, rack_seq));
+            if(!sent_before || now - slot_sent[id] < rack_rtt + reo_wnd)
+                continue;
+            SENDER_INFO("--> Packet seq = %d lost, resending", id);
+            slot_flags[id] |= RACK_LOST;
+            if(!single_timer) {
+                Timer_CancelTimeout(id);
+                Timer_AddTimeout(id, Rto());
+            }
+            Resend(id);
+        }
+    }
+
+    // an ACK or NAK with loss detection: both acknowledge cumulatively and 
+    // carry a SACK map, losses are inferred from what got through
+    // take the packets the SACK map of "rdtmsg" reports held as delivered, "cum"
+    // being the last one acknowledged cumulatively.  their timers go: a held 
+    // packet is only acknowledged cumulatively once the holes before it are 
+    // repaired, at least a round trip after the NAK, and would time out first.
+    void Sacked(const rdt_message *rdtmsg, seqn_t cum) {
+        // bit i of the SACK map stands for cum + 2 + i
+        int off = rdtmsg->sack_offset();
+        const uint8_t *sack = (const uint8_t *)rdtmsg->payload + off;
+        for(int i = 0; i < (rdtmsg->len - off) * 8; i++) {
+            if(!(sack[i / 8] & (1 << (i % 8)))) continue;
+            seqn_t id = add(cum, 2 + i);
+            if(!between(window_start, id, to_send)) break;
+            if(slot_flags[id] & rdt_message::ACKED) continue;
+            if(rack)
+                Rack_Delivered(id);
+            else
+                Delivered(id);
+            if(!single_timer) Timer_CancelTimeout(id);
+        }
+    }
+
+    void Rack_FromLowerLayer(rdt_message *rdtmsg) {
+        seqn_t cum = !rdtmsg->is_nak() ? rdtmsg->ack : minus(rdtmsg->ack, 1);
+        SENDER_INFO("o<- %s = %d", !rdtmsg->is_nak() ? "ack" : "nak", rdtmsg->ack);
+        for(seqn_t id = window_start; lte(id, cum); inc(id))
+            if(!(slot_flags[id] & rdt_message::ACKED))
+                Rack_Delivered(id);
+        Acknowledge(cum);
+        Sacked(rdtmsg, cum);
+        Rack_DetectLoss();
+        SendPackets();
+    }
+
+public:
+    /* event handler, called when a packet is passed from the lower layer at the 
+       sender */
+    void FromLowerLayer(packet_type *pkt)
+    {
+        rdt_message *rdtmsg = (rdt_message *)pkt;
+        // check validity
+        if(rdtmsg->check() == false) {
+            SENDER_INFO("x<- Packet corrupted.");
+            return;
+        }
+        if(rdtmsg->flags & rdt_message::SYN) {
+            bool was_established = established;
+            Established(rdtmsg);
+            if(!was_established)
+                SendPackets();
+            return;
+        }
+        if(!established) return;
+        // with timestamps every reply gives an RTT sample, whatever it 
+        // acknowledges and however often the packets were sent
+        echo_valid = params.timestamps && (rdtmsg->flags & rdt_message::TS);
+        if(echo_valid) {
+            echo = rdtmsg->ts_ecr();
+            RttSample(ts_diff(to_timestamp(lower.now()), echo));
+        }
+        // the receive window comes with every reply
+        peer_window = std::min(rdtmsg->seq, WINDOW_MAX);
+        if(rack) {
+            Rack_FromLowerLayer(rdtmsg);
+        } else if(!rdtmsg->is_nak()) {
+            // received ack, advance window position
+            SENDER_INFO("o<- ack = %d", rdtmsg->ack);
+            Acknowledge(rdtmsg->ack);
+            Sacked(rdtmsg, rdtmsg->ack);
+            SendPackets();
+        } else {
+            // received nak, everything before it got through
+            SENDER_INFO("o<- nak = %d", rdtmsg->ack);
+            Acknowledge(minus(rdtmsg->ack, 1));
+            Sacked(rdtmsg, minus(rdtmsg->ack, 1));
+            // resend the packets of the holes it lists
+            int n = rdtmsg->len > 0 ? (uint8_t)rdtmsg->payload[0] : 0;
+            for(int i = 0; i < n &&
+                1 + (2 * i + 2) * (int)sizeof(seqn_t) <= rdtmsg->len; i++) {
+                for(seqn_t seq = rdtmsg->hole(2 * i); ; inc(seq)) {
+                    if(!between(window_start, seq, to_send)) {
+                        // nak is less than ack, packet reordered.
+                        SENDER_INFO("Ignoring nak of %d since ack = %d", seq, window_start);
+                        break;
+                    }
+                    ResendOnNak(seq);
+                    if(seq == rdtmsg->hole(2 * i + 1)) break;
+                }
+            }
+            SendPackets();
+        }
+    }
+};
+
+#endif  /* _RDT_BASIC_SENDER_H_ */
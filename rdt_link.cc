@@ -0,0 +1,76 @@
+/*
+ * FILE: rdt_link.cc
+ * DESCRIPTION: The link model shared by the simulator and the UDP proxy.
+ */
+
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rdt_link.h"
+
+void rng_bytes(uint64_t &state, uint8_t *buf, int len)
+{
+    int i = 0;
+    for (; i+8<=len; i+=8) {
+	uint64_t r = rng_next(state);
+	memcpy(buf+i, &r, 8);
+    }
+    if (i<len) {
+	uint64_t r = rng_next(state);
+	memcpy(buf+i, &r, len-i);
+    }
+}
+
+void link_corrupt(uint64_t &rng, char *data, int len)
+{
+    uint8_t noise[16];
+    int i = 0;
+#ifdef __SSE2__
+    /* offset = noise*20/256 - 10, 16 bytes at a time */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i twenty = _mm_set1_epi16(20);
+    const __m128i ten = _mm_set1_epi8(10);
+    for (; i+16<=len; i+=16) {
+	rng_bytes(rng, noise, 16);
+	__m128i r = _mm_loadu_si128((const __m128i*) noise);
+	__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), twenty), 8);
+	__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), twenty), 8);
+	__m128i offset = _mm_sub_epi8(_mm_packus_epi16(lo, hi), ten);
+	__m128i d = _mm_loadu_si128((const __m128i*)(data+i));
+	_mm_storeu_si128((__m128i*)(data+i), _mm_add_epi8(d, offset));
+    }
+#endif
+    for (; i<len; i+=16) {
+	int n = (len-i<16) ? len-i : 16;
+	rng_bytes(rng, noise, n);
+	for (int j=0; j<n; j++)
+	    data[i+j] = data[i+j] + (char)((noise[j]*20)>>8) - 10;
+    }
+}
+
+LinkFate link_apply(const LinkModel &m, uint64_t &rng, char *data, int len)
+{
+    LinkFate fate = {false, false, m.latency};
+
+    /* packet lost at rate "loss_rate" */
+    if (rng_uniform(rng)<m.loss_rate) {
+	fate.lost = true;
+	return fate;
+    }
+
+    /* packet corrupted at rate "corrupt_rate" */
+    if (rng_uniform(rng)<m.corrupt_rate) {
+	link_corrupt(rng, data, len);
+	fate.corrupted = true;
+    }
+
+    /* delivered with a random latency at rate "outoforder_rate" */
+    if (rng_uniform(rng)<m.outoforder_rate) {
+	fate.latency = (simtick_t)(m.latency*2.0*rng_uniform(rng) + 0.5);
+	if (fate.latency<m.latency_floor) fate.latency = m.latency_floor;
+    }
+    return fate;
+}
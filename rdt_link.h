@@ -0,0 +1,70 @@
+/*
+ * FILE: rdt_link.h
+ * DESCRIPTION: The link model shared by the simulator and the UDP proxy:
+ *              random number streams, packet loss, corruption and latency.
+ */
+
+
+#ifndef _RDT_LINK_H_
+#define _RDT_LINK_H_
+
+#include <stdint.h>
+
+#include "rdt_struct.h"
+
+/* advance a random number stream (xorshift64*), the state must not be 0 */
+inline uint64_t rng_next(uint64_t &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+/* seed a random number stream (splitmix64 of the seed) */
+inline uint64_t rng_seed(uint64_t seed)
+{
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+/* generate a random number in [0,1) */
+inline double rng_uniform(uint64_t &state)
+{
+    return (rng_next(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+/* fill "len" bytes with random bits, eight bytes per draw */
+void rng_bytes(uint64_t &state, uint8_t *buf, int len);
+
+/* impairments of one direction of a link */
+struct LinkModel
+{
+    double loss_rate;           /* probability that a packet is lost */
+    double corrupt_rate;        /* probability that a packet is corrupted */
+    double outoforder_rate;     /* probability of a random latency */
+    simtick_t latency;          /* normal one-way latency */
+    simtick_t latency_floor;    /* lower bound of a random latency */
+};
+
+/* what happens to one packet on the link */
+struct LinkFate
+{
+    bool lost;
+    bool corrupted;
+    simtick_t latency;          /* undefined if the packet is lost */
+};
+
+/* decide the fate of the "len" bytes at "data" put on the link, corrupting 
+   them in place.  loss, corruption and latency are drawn from "rng" in this 
+   order, so the same stream gives the same fates wherever the model runs.
+   a random latency is uniform in [0, 2*latency], raised to latency_floor. */
+LinkFate link_apply(const LinkModel &m, uint64_t &rng, char *data, int len);
+
+/* add a random offset in [-10,9] to every one of "len" bytes */
+void link_corrupt(uint64_t &rng, char *data, int len);
+
+#endif  /* _RDT_LINK_H_ */
@@ -0,0 +1,117 @@
+/*
+ * FILE: rdt_pcap.cc
+ * DESCRIPTION: Buffered pcapng writer for the packets crossing the simulated
+ *              link.  see rdt.lua for a Wireshark dissector of the packets.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdt_pcap.h"
+
+#define PCAP_BUFSIZE (1<<16)
+
+/* pcapng block types, options and link type */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_LINKTYPE_USER0 147
+
+/* epb_flags direction bits */
+#define PCAPNG_INBOUND 1
+#define PCAPNG_OUTBOUND 2
+
+/* length of "len" rounded up to 32 bits */
+static int pad4(int len)
+{
+    return (len + 3) & ~3;
+}
+
+PcapWriter::PcapWriter()
+{
+    fp = NULL;
+    buf = NULL;
+    used = 0;
+}
+
+PcapWriter::~PcapWriter()
+{
+    close();
+}
+
+void PcapWriter::flush()
+{
+    if (used>0) fwrite(buf, 1, used, fp);
+    used = 0;
+}
+
+void PcapWriter::append(const void *data, int len)
+{
+    if (used+len>PCAP_BUFSIZE) flush();
+    memcpy(buf+used, data, len);
+    used += len;
+}
+
+bool PcapWriter::open(const char *path)
+{
+    fp = fopen(path, "wb");
+    if (fp==NULL) return false;
+    buf = (char*) malloc(PCAP_BUFSIZE);
+    ASSERT(buf!=NULL);
+
+    /* section header block */
+    uint32_t shb[7] = {PCAPNG_SHB, 28, 0x1A2B3C4D, 1 /* major 1, minor 0 */, 
+		       0xFFFFFFFF, 0xFFFFFFFF /* unknown section length */, 28};
+    append(shb, sizeof(shb));
+
+    /* interface description block, timestamps in nanoseconds */
+    uint32_t idb[8] = {PCAPNG_IDB, 32, PCAPNG_LINKTYPE_USER0, RDT_PKTSIZE,
+		       PCAPNG_OPT_IF_TSRESOL | (1<<16), 9, 
+		       PCAPNG_OPT_ENDOFOPT, 32};
+    append(idb, sizeof(idb));
+    return true;
+}
+
+void PcapWriter::write(simtick_t time, const struct packet *pkt, int flow, 
+		       int annotations)
+{
+    char comment[64];
+    int comment_len = snprintf(comment, sizeof(comment), "flow %d%s%s%s", flow,
+			       (annotations & PCAP_LOST) ? ", lost" : "",
+			       (annotations & PCAP_CORRUPTED) ? ", corrupted" : "",
+			       (annotations & PCAP_DROPPED) ? ", dropped at bottleneck" : "");
+    uint32_t epb_flags = (annotations & PCAP_TO_SENDER) ? PCAPNG_INBOUND : PCAPNG_OUTBOUND;
+
+    /* header, packet, flags option, comment option, end of options, trailer */
+    uint32_t total = 28 + RDT_PKTSIZE + 8 + 4 + pad4(comment_len) + 4 + 4;
+    uint32_t header[7] = {PCAPNG_EPB, total, 0, (uint32_t)((uint64_t)time>>32),
+			  (uint32_t)time, RDT_PKTSIZE, RDT_PKTSIZE};
+    uint32_t flags_opt[3] = {PCAPNG_OPT_EPB_FLAGS | (4<<16), epb_flags,
+			     PCAPNG_OPT_COMMENT | ((uint32_t)comment_len<<16)};
+    uint32_t trailer[2] = {PCAPNG_OPT_ENDOFOPT, total};
+    static const char zeros[4] = {0, 0, 0, 0};
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (fp==NULL) return;
+    append(header, sizeof(header));
+    append(pkt->data, RDT_PKTSIZE);
+    append(flags_opt, sizeof(flags_opt));
+    append(comment, comment_len);
+    append(zeros, pad4(comment_len)-comment_len);
+    append(trailer, sizeof(trailer));
+}
+
+void PcapWriter::close()
+{
+    if (fp==NULL) return;
+    flush();
+    fclose(fp);
+    free(buf);
+    fp = NULL;
+    buf = NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * FILE: rdt_pcap.h
+ * DESCRIPTION: Buffered pcapng writer for the packets crossing the simulated
+ *              link.
+ */
+
+
+#ifndef _RDT_PCAP_H_
+#define _RDT_PCAP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <mutex>
+
+#include "rdt_struct.h"
+
+/* annotations of a captured packet */
+enum {
+    PCAP_TO_RECEIVER = 0,   /* direction: data path */
+    PCAP_TO_SENDER = 1,     /* direction: feedback path */
+    PCAP_LOST = 2,          /* lost on the link */
+    PCAP_CORRUPTED = 4,     /* corrupted on the link */
+    PCAP_DROPPED = 8,       /* dropped at the bottleneck */
+};
+
+/* writes packets into a pcapng file with one interface of link type USER0 
+   and nanosecond timestamps.  blocks are collected in a memory buffer and 
+   written out when it fills up.  every call is serialized, so LPs of a 
+   parallel simulation can share one writer; the packet order in the file then
+   follows the order of the calls. */
+class PcapWriter
+{
+    FILE *fp;
+    char *buf;              /* output buffer */
+    int used;               /* bytes in the output buffer */
+    std::mutex mtx;
+
+    void append(const void *data, int len);
+    void flush();
+
+public:
+    PcapWriter();
+    ~PcapWriter();
+
+    /* create the file and write the section and interface headers, returns 
+       false if the file can't be created */
+    bool open(const char *path);
+
+    /* record a packet of flow "flow" at simulation time "time" */
+    void write(simtick_t time, const struct packet *pkt, int flow, int annotations);
+
+    /* flush the buffer and close the file */
+    void close();
+};
+
+#endif  /* _RDT_PCAP_H_ */
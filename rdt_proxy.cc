@@ -0,0 +1,445 @@
+/*
+ * FILE: rdt_proxy.cc
+ * DESCRIPTION: A network emulator that forwards UDP datagrams between a
+ *              sender and a receiver, applying the link model of the
+ *              simulator (loss, corruption, reordering, latency) and an
+ *              optional bandwidth limit in real time.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "rdt_struct.h"
+#include "rdt_link.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  hashed timer wheel holding datagrams in flight
+  []------------------------------------------------------------------------[]*/
+
+/* granularity and size of the wheel: 100us slots, 409.6ms per revolution.
+   datagrams due further away stay in their slot for several rounds. */
+#define WHEEL_TICK	100000LL
+#define WHEEL_SLOTS	4096
+
+/* a datagram waiting for its delivery time */
+struct Datagram
+{
+    simtick_t due;
+    int dir;
+    int len;
+    Datagram *next;
+    char data[1];       /* "len" bytes allocated with the datagram */
+};
+
+struct TimerWheel
+{
+    Datagram *head[WHEEL_SLOTS];
+    Datagram *tail[WHEEL_SLOTS];
+    simtick_t tick;     /* current wheel tick, all slots before it are done */
+    int pending;
+};
+
+static void wheel_init(TimerWheel &w, simtick_t now)
+{
+    memset(w.head, 0, sizeof(w.head));
+    memset(w.tail, 0, sizeof(w.tail));
+    w.tick = now/WHEEL_TICK;
+    w.pending = 0;
+}
+
+/* file a datagram in the slot of its due time, in arrival order */
+static void wheel_insert(TimerWheel &w, Datagram *d)
+{
+    simtick_t tick = d->due/WHEEL_TICK;
+    if (tick<w.tick) tick = w.tick;
+    int slot = tick & (WHEEL_SLOTS-1);
+
+    d->next = NULL;
+    if (w.tail[slot]==NULL)
+	w.head[slot] = d;
+    else
+	w.tail[slot]->next = d;
+    w.tail[slot] = d;
+    w.pending ++;
+}
+
+/* unlink the datagrams of one slot due by "now" and pass them to "deliver" */
+template<typename F>
+static void wheel_expire_slot(TimerWheel &w, int slot, simtick_t now, F deliver)
+{
+    Datagram **pp = &w.head[slot], *last = NULL;
+    while (*pp!=NULL) {
+	Datagram *d = *pp;
+	if (d->due<=now) {
+	    *pp = d->next;
+	    w.pending --;
+	    deliver(d);
+	} else {
+	    last = d;
+	    pp = &d->next;
+	}
+    }
+    w.tail[slot] = last;
+}
+
+/* move the wheel to "now", delivering everything that became due */
+template<typename F>
+static void wheel_advance(TimerWheel &w, simtick_t now, F deliver)
+{
+    simtick_t now_tick = now/WHEEL_TICK;
+    if (w.pending==0) {
+	if (w.tick<now_tick) w.tick = now_tick;
+	return;
+    }
+
+    /* one revolution visits every slot, no need to turn further */
+    if (now_tick-w.tick>WHEEL_SLOTS) w.tick = now_tick-WHEEL_SLOTS;
+    for (; w.tick<now_tick; w.tick++)
+	wheel_expire_slot(w, w.tick & (WHEEL_SLOTS-1), now, deliver);
+    wheel_expire_slot(w, w.tick & (WHEEL_SLOTS-1), now, deliver);
+}
+
+/* time to wait for the earliest pending datagram, -1 if there is none.
+   the slots are scanned from the current one on until a slot can't hold 
+   anything earlier than what was found, a datagram for a later round may 
+   sit in an earlier slot. */
+static simtick_t wheel_timeout(const TimerWheel &w, simtick_t now)
+{
+    if (w.pending==0) return -1;
+
+    simtick_t next = -1;
+    for (int i=0; i<WHEEL_SLOTS; i++) {
+	simtick_t tick = w.tick+i;
+	if (next>=0 && tick*WHEEL_TICK>=next) break;
+	for (Datagram *d = w.head[tick & (WHEEL_SLOTS-1)]; d!=NULL; d = d->next) {
+	    if (next<0 || d->due<next) next = d->due;
+	}
+    }
+    return next>now ? next-now : 0;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  proxy state
+  []------------------------------------------------------------------------[]*/
+
+/* the two directions of the emulated link */
+enum directions {
+    DIR_TO_RECEIVER = 0,
+    DIR_TO_SENDER = 1
+};
+
+struct Direction
+{
+    LinkModel model;
+    uint64_t rng;
+    simtick_t busy;             /* bandwidth limit: when the link is free */
+    unsigned long forwarded, lost, corrupted, dropped;
+    unsigned long failed;       /* the socket refused to send */
+    int last_errno;             /* error of the last failure reported */
+};
+
+Direction dirs[2];
+
+/* bandwidth limit in bytes per second, 0 for none */
+double bandwidth = 0;
+
+/* datagrams of the current size the link can hold before dropping */
+int queue_limit = 0;
+
+/* sock_sender faces the sender, sock_receiver is connected to the receiver */
+int sock_sender = -1, sock_receiver = -1;
+struct sockaddr_storage sender_addr;
+socklen_t sender_addrlen = 0;
+
+volatile sig_atomic_t stopped = 0;
+
+static void on_signal(int)
+{
+    stopped = 1;
+}
+
+static simtick_t monotonic_ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (simtick_t) ts.tv_sec*SIM_TICKS_PER_SEC + ts.tv_nsec;
+}
+
+static simtick_t to_ticks(double seconds)
+{
+    return (simtick_t)(seconds*SIM_TICKS_PER_SEC + 0.5);
+}
+
+/* put a datagram just read from the sender or the receiver on the link */
+static void link_enqueue(TimerWheel &w, int dir, const char *buf, int len, simtick_t now)
+{
+    Direction &d = dirs[dir];
+    simtick_t depart = now;
+
+    if (bandwidth>0) {
+	simtick_t tx = to_ticks(len/bandwidth);
+	if (d.busy<now) d.busy = now;
+	if (queue_limit>0 && d.busy-now>=queue_limit*tx) {
+	    d.dropped ++;
+	    return;
+	}
+	d.busy += tx;
+	depart = d.busy;
+    }
+
+    Datagram *dg = (Datagram*) malloc(sizeof(Datagram) + len);
+    ASSERT(dg);
+    memcpy(dg->data, buf, len);
+
+    LinkFate fate = link_apply(d.model, d.rng, dg->data, len);
+    if (fate.lost) {
+	d.lost ++;
+	free(dg);
+	return;
+    }
+    if (fate.corrupted) d.corrupted ++;
+
+    dg->dir = dir;
+    dg->len = len;
+    dg->due = depart + fate.latency;
+    wheel_insert(w, dg);
+}
+
+/* hand a datagram to the other end once its time has come */
+static void link_deliver(Datagram *dg)
+{
+    Direction &d = dirs[dg->dir];
+    ssize_t sent;
+    if (dg->dir==DIR_TO_RECEIVER) {
+	sent = send(sock_receiver, dg->data, dg->len, 0);
+    } else if (sender_addrlen>0) {
+	sent = sendto(sock_sender, dg->data, dg->len, 0,
+		      (struct sockaddr*) &sender_addr, sender_addrlen);
+    } else {
+	free(dg);
+	return;
+    }
+    if (sent<0) {
+	/* e.g. the receiver isn't listening yet, report each error once in
+	   a row */
+	d.failed ++;
+	if (errno!=d.last_errno)
+	    fprintf(stderr, "cannot forward %s: %s\n",
+		    dg->dir==DIR_TO_RECEIVER ? "to receiver" : "to sender", strerror(errno));
+	d.last_errno = errno;
+    } else {
+	d.forwarded ++;
+	d.last_errno = 0;
+    }
+    free(dg);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main
+  []------------------------------------------------------------------------[]*/
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b <bandwidth>] [-q <queue_limit>] "
+	    "[-f <latency_floor>] [-s <seed>] "
+	    "<listen_port> <receiver_host> <receiver_port> <latency> "
+	    "<outoforder_rate> <loss_rate> <corrupt_rate>\n",
+	    prog);
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long rand_seed = getpid()+getppid();
+    double latency_floor = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:q:f:s:"))!=-1) {
+	switch (opt) {
+	case 'b':
+	    bandwidth = atof(optarg);
+	    if (bandwidth<0) {
+		fprintf(stderr, "invalid <bandwidth>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'q':
+	    queue_limit = atoi(optarg);
+	    if (queue_limit<0) {
+		fprintf(stderr, "invalid <queue_limit>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'f':
+	    latency_floor = atof(optarg);
+	    if (latency_floor<0) {
+		fprintf(stderr, "invalid <latency_floor>\n");
+		exit(-1);
+	    }
+	    break;
+	case 's':
+	    rand_seed = strtoul(optarg, NULL, 0);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (argc-optind!=7) usage(argv[0]);
+
+    int listen_port = atoi(argv[optind]);
+    const char *receiver_host = argv[optind+1];
+    const char *receiver_port = argv[optind+2];
+    double latency = atof(argv[optind+3]);
+    double outoforder_rate = atof(argv[optind+4]);
+    double loss_rate = atof(argv[optind+5]);
+    double corrupt_rate = atof(argv[optind+6]);
+    if (latency<0 || latency_floor>latency) {
+	fprintf(stderr, "invalid <latency>\n");
+	exit(-1);
+    }
+    if (outoforder_rate<0 || outoforder_rate>1) {
+	fprintf(stderr, "invalid <outoforder_rate>\n");
+	exit(-1);
+    }
+    if (loss_rate<0 || loss_rate>1) {
+	fprintf(stderr, "invalid <loss_rate>\n");
+	exit(-1);
+    }
+    if (corrupt_rate<0 || corrupt_rate>1) {
+	fprintf(stderr, "invalid <corrupt_rate>\n");
+	exit(-1);
+    }
+
+    for (int i=0; i<2; i++) {
+	dirs[i].model.loss_rate = loss_rate;
+	dirs[i].model.corrupt_rate = corrupt_rate;
+	dirs[i].model.outoforder_rate = outoforder_rate;
+	dirs[i].model.latency = to_ticks(latency);
+	dirs[i].model.latency_floor = to_ticks(latency_floor);
+	dirs[i].rng = rng_seed(((uint64_t)rand_seed<<32)+i);
+	dirs[i].busy = 0;
+	dirs[i].forwarded = dirs[i].lost = dirs[i].corrupted = dirs[i].dropped = 0;
+	dirs[i].failed = 0;
+	dirs[i].last_errno = 0;
+    }
+
+    /* the socket the sender talks to */
+    struct sockaddr_in6 local;
+    memset(&local, 0, sizeof(local));
+    local.sin6_family = AF_INET6;
+    local.sin6_addr = in6addr_any;
+    local.sin6_port = htons(listen_port);
+    sock_sender = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sock_sender<0) {
+	fprintf(stderr, "cannot create socket: %s\n", strerror(errno));
+	exit(-1);
+    }
+    int off = 0;
+    setsockopt(sock_sender, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    if (bind(sock_sender, (struct sockaddr*) &local, sizeof(local))<0) {
+	fprintf(stderr, "cannot listen on port %d: %s\n", listen_port, strerror(errno));
+	exit(-1);
+    }
+
+    /* the socket connected to the receiver */
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int err = getaddrinfo(receiver_host, receiver_port, &hints, &ai);
+    if (err!=0) {
+	fprintf(stderr, "cannot resolve %s:%s: %s\n", receiver_host, receiver_port, gai_strerror(err));
+	exit(-1);
+    }
+    sock_receiver = socket(ai->ai_family, SOCK_DGRAM, 0);
+    if (sock_receiver<0 || connect(sock_receiver, ai->ai_addr, ai->ai_addrlen)<0) {
+	fprintf(stderr, "cannot connect to %s:%s: %s\n", receiver_host, receiver_port, strerror(errno));
+	exit(-1);
+    }
+    freeaddrinfo(ai);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stdout, "## Forwarding port %d <-> %s:%s\n", listen_port, receiver_host, receiver_port);
+    fprintf(stdout, "## Latency: %.3fs (floor %.3fs)\n", latency, latency_floor);
+    fprintf(stdout, "## Outoforder rate: %.2f, Loss rate: %.2f, Corrupt rate: %.2f\n",
+	    outoforder_rate, loss_rate, corrupt_rate);
+    if (bandwidth>0)
+	fprintf(stdout, "## Bandwidth: %.0f bytes/s, queue limit %d\n", bandwidth, queue_limit);
+    fflush(stdout);
+
+    TimerWheel *wheel = new TimerWheel;
+    wheel_init(*wheel, monotonic_ticks());
+
+    static char buf[65536];
+    struct pollfd fds[2];
+    fds[0].fd = sock_sender;
+    fds[1].fd = sock_receiver;
+    fds[0].events = fds[1].events = POLLIN;
+
+    while (!stopped) {
+	simtick_t now = monotonic_ticks();
+	wheel_advance(*wheel, now, link_deliver);
+
+	simtick_t wait = wheel_timeout(*wheel, now);
+	struct timespec ts, *tsp = NULL;
+	if (wait>=0) {
+	    ts.tv_sec = wait/SIM_TICKS_PER_SEC;
+	    ts.tv_nsec = wait%SIM_TICKS_PER_SEC;
+	    tsp = &ts;
+	}
+	if (ppoll(fds, 2, tsp, NULL)<0) {
+	    if (errno==EINTR) continue;
+	    fprintf(stderr, "poll failed: %s\n", strerror(errno));
+	    exit(-1);
+	}
+
+	now = monotonic_ticks();
+	if (fds[0].revents & (POLLIN|POLLERR)) {
+	    struct sockaddr_storage from;
+	    socklen_t fromlen = sizeof(from);
+	    int len;
+	    while ((len = recvfrom(sock_sender, buf, sizeof(buf), MSG_DONTWAIT,
+				   (struct sockaddr*) &from, &fromlen))>=0) {
+		/* replies go to whoever sent last */
+		memcpy(&sender_addr, &from, fromlen);
+		sender_addrlen = fromlen;
+		link_enqueue(*wheel, DIR_TO_RECEIVER, buf, len, now);
+		fromlen = sizeof(from);
+	    }
+	}
+	if (fds[1].revents & (POLLIN|POLLERR)) {
+	    int len;
+	    while ((len = recv(sock_receiver, buf, sizeof(buf), MSG_DONTWAIT))>=0)
+		link_enqueue(*wheel, DIR_TO_SENDER, buf, len, now);
+	}
+    }
+
+    const char *names[2] = {"to receiver", "to sender"};
+    for (int i=0; i<2; i++) {
+	fprintf(stdout, "## %s: %lu datagrams forwarded, %lu lost, %lu corrupted, %lu dropped, "
+		"%lu failed\n", names[i], dirs[i].forwarded, dirs[i].lost, dirs[i].corrupted,
+		dirs[i].dropped, dirs[i].failed);
+    }
+
+    delete wheel;
+    return 0;
+}
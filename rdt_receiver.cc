@@ -1,94 +1,88 @@
 /*
  * FILE: rdt_receiver.cc
- * DESCRIPTION: Reliable data transfer receiver.
+ * DESCRIPTION: Reliable data transfer receiver.  The routines of 
+ *              rdt_receiver.h work on instances of basic_rdt_receiver 
+ *              (rdt_basic_receiver.h) built for the simulator.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
 #include "rdt_receiver.h"
-#include "rdt_utils.h"
+#include "rdt_basic_receiver.h"
+#include "rdt_sim_transport.h"
+
+// a receiver of the simulator
+struct receiver_state : basic_rdt_receiver<rdt_config, sim_transport<rdt_config>> {};
+
+static receiver_state default_state;
+// instance the routines of this thread work on
+static thread_local receiver_state *R = &default_state;
+
+struct receiver_state *Receiver_Create()
+{
+    return new receiver_state();
+}
+
+void Receiver_Destroy(struct receiver_state *r)
+{
+    if (R == r) R = &default_state;
+    delete r;
+}
 
-static seqn_t window_start;
-static seqn_t received_last;
-static rdt_message in_buf[MAX_SEQ + 1];
+void Receiver_Select(struct receiver_state *r)
+{
+    R = r;
+}
+
+struct receiver_state *Receiver_Selected()
+{
+    return R;
+}
+
+void Receiver_SetDeliveryQueue(bool on)
+{
+    R->SetDeliveryQueue(on);
+}
 
-/* receiver initialization, called once at the very beginning */
 void Receiver_Init()
 {
-    RECEIVER_INFO("Initializing...");
-    window_start = 0;
-    received_last = 0;
+    R->Init();
 }
 
-/* receiver finalization, called once at the very end.
-   you may find that you don't need it, in which case you can leave it blank.
-   in certain cases, you might want to use this opportunity to release some 
-   memory you allocated in Receiver_init(). */
 void Receiver_Final()
 {
-    RECEIVER_INFO("Finalizing...");
+    R->Final();
+}
+
+bool Receiver_Save(FILE *fp)
+{
+    return R->Save(fp);
+}
+
+bool Receiver_Restore(FILE *fp)
+{
+    return R->Restore(fp);
+}
+
+bool Receiver_Peek(struct receiver_state *r, struct message *msg)
+{
+    return r->Peek(msg);
+}
+
+bool Receiver_Consumed(struct receiver_state *r)
+{
+    return r->Consumed();
+}
+
+int Receiver_Reclaim()
+{
+    return R->Reclaim();
 }
 
-/* event handler, called when a packet is passed from the lower layer at the 
-   receiver */
 void Receiver_FromLowerLayer(struct packet *pkt)
 {
-    static rdt_message buffer;
-    rdt_message *rdtmsg = (rdt_message *)pkt;
-
-    // check packet
-    if(!rdtmsg->check()) {
-        RECEIVER_INFO("->x packet corrupted, seq = %d?", rdtmsg->seq);
-        return;
-    } else {
-        RECEIVER_INFO("->o seq = %d, window = %d", rdtmsg->seq, window_start);
-    }
-    
-    // if this packet's sequence number is within our range
-    if(!lt(rdtmsg->seq, window_start)) {
-        // update the lastest received packet number
-        if(lt(received_last, rdtmsg->seq))
-            received_last = rdtmsg->seq;
-        // copy to our internal buffer
-        memcpy(in_buf + rdtmsg->seq, rdtmsg, sizeof(rdt_message));
-        rdtmsg = in_buf + rdtmsg->seq;
-        // set received flag
-        rdtmsg->flags |= rdt_message::RECEIVED;
-
-        // send content to upper layer
-        while(in_buf[window_start].flags & rdt_message::RECEIVED) {
-            message msg = message{
-                int(in_buf[window_start].len), in_buf[window_start].payload};
-            Receiver_ToUpperLayer(&msg);
-            // invalidate this buffer by unsetting RECEIVED
-            in_buf[window_start].flags &= ~rdt_message::RECEIVED;
-            inc(window_start);
-        }
-
-        // the next frame has yet not been received, send nak
-        // we don't have timer on receiver side, so we keep sending back nak
-        // until sender sends back the desired packet.
-        if(lt(window_start, received_last)) {
-            buffer.seq = 0;
-            buffer.ack = window_start;
-            buffer.flags = rdt_message::NAK;
-            buffer.len = 0;
-            buffer.fill_checksum();
-            RECEIVER_INFO("<-- nak = %d", window_start);
-            Receiver_ToLowerLayer((packet *)&buffer);
-            return;
-        }
-    } else {
-        RECEIVER_WARNING("Packet seq less than window number, not saved.");
-    }
-    // send back ack
-    buffer.seq = 0; // not a duplex protocol
-    buffer.ack = (window_start - 1) & MAX_SEQ;
-    buffer.flags = rdt_message::ACK;
-    buffer.len = 0;
-    buffer.fill_checksum();
-    RECEIVER_INFO("<-- ack = %d", buffer.ack);
-    Receiver_ToLowerLayer((packet *)&buffer);
+    R->FromLowerLayer((receiver_state::packet_type *)pkt);
+}
+
+void Receiver_AdoptFromLowerLayer(struct packet *pkt)
+{
+    R->AdoptFromLowerLayer((receiver_state::packet_type *)pkt);
 }
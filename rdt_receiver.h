@@ -8,6 +8,8 @@
 #ifndef _RDT_RECEIVER_H_
 #define _RDT_RECEIVER_H_
 
+#include <stdio.h>
+
 #include "rdt_struct.h"
 
 
@@ -18,9 +20,24 @@
 /* get simulation time (in seconds) */
 double GetSimulationTime();
 
+/* get simulation time (in ticks, see SIM_TICKS_PER_SEC) */
+simtick_t GetSimulationTicks();
+
 /* pass a packet to the lower layer at the receiver */
 void Receiver_ToLowerLayer(struct packet *pkt);
 
+/* get an empty packet buffer from the lower layer.  the caller owns it until
+   it is passed on with Receiver_ToLowerLayerBuffer() or given back with 
+   Packet_Release(). */
+struct packet *Packet_Acquire();
+
+/* give a packet buffer back to the lower layer */
+void Packet_Release(struct packet *pkt);
+
+/* pass a packet buffer from Packet_Acquire() to the lower layer at the 
+   receiver without copying it, the lower layer takes over the buffer */
+void Receiver_ToLowerLayerBuffer(struct packet *pkt);
+
 /* deliver a message to the upper layer at the receiver */
 void Receiver_ToUpperLayer(struct message *msg);
 
@@ -43,4 +60,60 @@ void Receiver_Final();
    receiver */
 void Receiver_FromLowerLayer(struct packet *pkt);
 
+/* event handler, same as Receiver_FromLowerLayer() except that the receiver 
+   takes over the packet buffer and Packet_Release()s it once done */
+void Receiver_AdoptFromLowerLayer(struct packet *pkt);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines for running several receivers in one process
+  []------------------------------------------------------------------------[]*/
+
+/* the routines above act on the receiver instance selected by the calling 
+   thread, a default instance is selected initially. */
+struct receiver_state;
+
+/* create a new receiver instance, Receiver_Init() it after selecting it */
+struct receiver_state *Receiver_Create();
+
+/* release a receiver instance */
+void Receiver_Destroy(struct receiver_state *r);
+
+/* select the receiver instance the calling thread works on */
+void Receiver_Select(struct receiver_state *r);
+
+/* the receiver instance the calling thread works on */
+struct receiver_state *Receiver_Selected();
+
+/* switch the delivery queue of the selected instance on or off, before 
+   Receiver_Init().  with it on, Receiver_ToUpperLayer() is not called: 
+   messages are queued for the application to take with Receiver_Peek() on
+   a thread of its own, and the receive window shrinks as they pile up.
+   queued messages are not part of a snapshot. */
+void Receiver_SetDeliveryQueue(bool on);
+
+/* the oldest message queued by receiver instance "r", false if there is 
+   none.  to be called by one application thread.  "msg" points into the 
+   packet buffer and stays valid until Receiver_Consumed(). */
+bool Receiver_Peek(struct receiver_state *r, struct message *msg);
+
+/* done with the message from Receiver_Peek().  returns true if the window
+   of "r" was held down by the queue, the thread working on it should then
+   call Receiver_Reclaim() to announce the space. */
+bool Receiver_Consumed(struct receiver_state *r);
+
+/* give the buffers of consumed messages back to the lower layer and send a
+   window update if the window has opened enough since the last reply.  for
+   the thread working on the selected instance, the receiver does the same 
+   on every packet.  returns the number of buffers given back. */
+int Receiver_Reclaim();
+
+/* write the state of the selected receiver instance to a snapshot file,
+   returns false on a write error */
+bool Receiver_Save(FILE *fp);
+
+/* restore the selected receiver instance from a snapshot written by 
+   Receiver_Save(), in place of Receiver_Init().  returns false on a read error */
+bool Receiver_Restore(FILE *fp);
+
 #endif  /* _RDT_RECEIVER_H_ */
@@ -8,6 +8,8 @@
 #ifndef _RDT_SENDER_H_
 #define _RDT_SENDER_H_
 
+#include <stdio.h>
+
 #include "rdt_struct.h"
 
 
@@ -18,12 +20,18 @@
 /* get simulation time (in seconds) */
 double GetSimulationTime();
 
+/* get simulation time (in ticks, see SIM_TICKS_PER_SEC) */
+simtick_t GetSimulationTicks();
+
 /* start the sender timer with a specified timeout (in seconds).
    the timer is canceled with Sender_StopTimer() is called or a new 
    Sender_StartTimer() is called before the current timer expires.
    Sender_Timeout() will be called when the timer expires. */
 void Sender_StartTimer(double timeout);
 
+/* start the sender timer with a specified timeout (in ticks) */
+void Sender_StartTimerTicks(simtick_t timeout);
+
 /* stop the sender timer */
 void Sender_StopTimer();
 
@@ -34,6 +42,18 @@ bool Sender_isTimerSet();
 /* pass a packet to the lower layer at the sender */
 void Sender_ToLowerLayer(struct packet *pkt);
 
+/* get an empty packet buffer from the lower layer.  the caller owns it until
+   it is passed on with Sender_ToLowerLayerBuffer() or given back with 
+   Packet_Release(). */
+struct packet *Packet_Acquire();
+
+/* give a packet buffer back to the lower layer */
+void Packet_Release(struct packet *pkt);
+
+/* pass a packet buffer from Packet_Acquire() to the lower layer at the 
+   sender without copying it, the lower layer takes over the buffer */
+void Sender_ToLowerLayerBuffer(struct packet *pkt);
+
 
 /*[]------------------------------------------------------------------------[]
   |  routines to be changed/enhanced by you
@@ -60,4 +80,84 @@ void Sender_FromLowerLayer(struct packet *pkt);
 /* event handler, called when the timer expires */
 void Sender_Timeout();
 
+
+/*[]------------------------------------------------------------------------[]
+  |  routines for running several senders in one process
+  []------------------------------------------------------------------------[]*/
+
+/* the routines above act on the sender instance selected by the calling 
+   thread, a default instance is selected initially. */
+struct sender_state;
+
+/* create a new sender instance, Sender_Init() it after selecting it */
+struct sender_state *Sender_Create();
+
+/* release a sender instance */
+void Sender_Destroy(struct sender_state *s);
+
+/* select the sender instance the calling thread works on */
+void Sender_Select(struct sender_state *s);
+
+/* the sender instance the calling thread works on */
+struct sender_state *Sender_Selected();
+
+/* switch the selected instance between one timer per outstanding packet 
+   (default) and a single retransmission timer for the whole window, before 
+   Sender_Init().  a restored instance keeps the mode of its snapshot. */
+void Sender_SetSingleTimer(bool on);
+
+/* switch time-based loss detection (RACK) of the selected instance on or off,
+   before Sender_Init().  with it on, NAKs only acknowledge and packets are 
+   resent once later packets got through and a reordering window passed. */
+void Sender_SetLossDetection(bool on);
+
+/* set the transport parameters the selected instance offers in its 
+   handshake, before Sender_Init().  0 keeps the default (the largest) value,
+   the receiver may agree to less.  the timestamp option takes 8 bytes off 
+   the largest payload. */
+void Sender_SetOffer(int max_window, int mtu, int ack_freq, bool timestamps);
+
+/* pass a message to sender instance "s" from any thread, without locking
+   or allocating.  the data is copied into nodes preallocated with the 
+   instance, it goes to the instance when the thread working on it calls 
+   Sender_Drain().  returns 1 if nothing else was pending, the caller should
+   then wake that thread, and 0 if it was queued behind other messages.
+   returns -1 if too few nodes are free, nothing is queued then and the
+   caller should retry once that thread drained. */
+int Sender_Submit(struct sender_state *s, const struct message *msg);
+
+/* pass the messages submitted to the selected instance on as 
+   Sender_FromUpperLayer() would, all at once and in the order of their 
+   submission (the order among threads is the order they got queued in).
+   returns how many there were. */
+int Sender_Drain();
+
+/* whether everything passed from the upper layer to the selected instance 
+   has been acknowledged */
+bool Sender_Idle();
+
+/* transmission statistics of a sender instance */
+struct sender_stats {
+    unsigned long sent;             /* data packets sent for the first time */
+    unsigned long retransmitted;    /* data packets sent again */
+    unsigned long retx_bytes;       /* payload bytes of those */
+    unsigned long spurious;         /* retransmissions an earlier copy made 
+                                       unneeded */
+    unsigned long spurious_bytes;   /* payload bytes of those */
+    unsigned long acked;            /* data packets acknowledged */
+    simtick_t ack_delay;            /* sum of the times from their first 
+                                       transmission to the acknowledgement */
+};
+
+/* read the statistics of the selected sender instance */
+void Sender_GetStats(struct sender_stats *stats);
+
+/* write the state of the selected sender instance to a snapshot file,
+   returns false on a write error */
+bool Sender_Save(FILE *fp);
+
+/* restore the selected sender instance from a snapshot written by 
+   Sender_Save(), in place of Sender_Init().  returns false on a read error */
+bool Sender_Restore(FILE *fp);
+
 #endif  /* _RDT_SENDER_H_ */
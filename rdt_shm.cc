@@ -0,0 +1,273 @@
+/*
+ * FILE: rdt_shm.cc
+ * DESCRIPTION: Runs the reliable data transfer sender and receiver as two
+ *              processes on one host, exchanging packets through rings in a
+ *              shared memory segment.  The sender sends standard input, the
+ *              receiver writes what it receives to standard output.  The
+ *              protocol runs over shm_transport (see rdt_shm_transport.h), 
+ *              in the quiet configuration or with -w the wide one (see 
+ *              rdt_utils.h).
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <new>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+
+#include "rdt_struct.h"
+#include "rdt_utils.h"
+#include "rdt_basic_sender.h"
+#include "rdt_basic_receiver.h"
+#include "rdt_shm_transport.h"
+
+
+/* the eventfd this side sleeps on */
+static int wake_rx;
+
+static simtick_t monotonic_ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (simtick_t) ts.tv_sec*SIM_TICKS_PER_SEC + ts.tv_nsec;
+}
+
+/* poll "fds" until the sender timer of "shm" expires, or not at all unless
+   "sleep" is set.  the first descriptor is the eventfd, it is drained. */
+template <class Endpoint>
+static void wait_events(Endpoint &shm, struct pollfd *fds, int nfds, bool sleep)
+{
+    struct timespec ts, *tsp = NULL;
+    if (!sleep || shm.deadline>=0) {
+	simtick_t wait = sleep ? shm.deadline-(monotonic_ticks()-shm.origin) : 0;
+	if (wait<0) wait = 0;
+	ts.tv_sec = wait/SIM_TICKS_PER_SEC;
+	ts.tv_nsec = wait%SIM_TICKS_PER_SEC;
+	tsp = &ts;
+    }
+    if (ppoll(fds, nfds, tsp, NULL)<0) {
+	if (errno==EINTR) return;
+	fprintf(stderr, "poll failed: %s\n", strerror(errno));
+	exit(-1);
+    }
+    if (fds[0].revents & POLLIN) {
+	uint64_t count;
+	if (read(wake_rx, &count, sizeof(count))<0 && errno!=EAGAIN) {
+	    fprintf(stderr, "cannot read eventfd: %s\n", strerror(errno));
+	    exit(-1);
+	}
+    }
+}
+
+template <class Endpoint>
+static void report(const Endpoint &shm, const char *side)
+{
+    fprintf(stderr, "## %s: %lu packets sent, %lu lost, %lu corrupted, "
+	    "%lu dropped on a full ring, %lu wake-ups\n", side, shm.sent,
+	    shm.lost, shm.corrupted, shm.full, shm.wakeups);
+}
+
+template <class Config, class Segment>
+static int run_sender(Segment *seg, shm_endpoint<typename shm_transport<Config>::packet_type> &shm,
+		      int wake_peer)
+{
+    typedef shm_transport<Config> transport;
+    static char buf[4096];
+    struct pollfd fds[2];
+    fds[0].fd = wake_rx;
+    fds[1].fd = STDIN_FILENO;
+    fds[0].events = fds[1].events = POLLIN;
+    bool eof = false;
+
+    basic_rdt_sender<Config, transport> *sender =
+	new basic_rdt_sender<Config, transport>(transport(&shm));
+    sender->Init();
+    while (!(eof && sender->Idle())) {
+	/* standard input is polled without sleeping while acks come in, and
+	   only while less than a largest window waits to be sent */
+	bool in = !eof && sender->Pending()<(size_t) Config::window_max;
+	bool sleep = ring_prepare_wait(*shm.rx);
+	fds[1].revents = 0;
+	wait_events(shm, fds, in ? 2 : 1, sleep);
+	ring_end_wait(*shm.rx);
+
+	typename transport::packet_type pkt;
+	while (ring_pop(*shm.rx, &pkt))
+	    sender->FromLowerLayer(&pkt);
+	if (!eof && (fds[1].revents & (POLLIN|POLLHUP))) {
+	    int len = read(STDIN_FILENO, buf, sizeof(buf));
+	    if (len<=0) {
+		eof = true;
+	    } else {
+		struct message msg = {len, buf};
+		sender->FromUpperLayer(&msg);
+	    }
+	}
+	if (shm.deadline>=0 && monotonic_ticks()-shm.origin>=shm.deadline) {
+	    shm.deadline = -1;
+	    sender->Timeout();
+	}
+    }
+    sender->Final();
+    delete sender;
+
+    /* everything is acknowledged, let the receiver go */
+    seg->closed.store(1);
+    uint64_t one = 1;
+    if (write(wake_peer, &one, sizeof(one))<0) {
+	fprintf(stderr, "cannot write eventfd: %s\n", strerror(errno));
+	exit(-1);
+    }
+    report(shm, "sender");
+    return 0;
+}
+
+template <class Config, class Segment>
+static int run_receiver(Segment *seg, shm_endpoint<typename shm_transport<Config>::packet_type> &shm)
+{
+    typedef shm_transport<Config> transport;
+    struct pollfd fds[1];
+    fds[0].fd = wake_rx;
+    fds[0].events = POLLIN;
+
+    basic_rdt_receiver<Config, transport> *receiver =
+	new basic_rdt_receiver<Config, transport>(transport(&shm));
+    receiver->Init();
+    for (;;) {
+	typename transport::packet_type pkt;
+	while (ring_pop(*shm.rx, &pkt))
+	    receiver->FromLowerLayer(&pkt);
+	fflush(shm.out);
+
+	if (ring_prepare_wait(*shm.rx)) {
+	    if (seg->closed.load()) break;
+	    wait_events(shm, fds, 1, true);
+	}
+	ring_end_wait(*shm.rx);
+    }
+    receiver->Final();
+    fflush(shm.out);
+    delete receiver;
+    report(shm, "receiver");
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-l <loss_rate>] [-c <corrupt_rate>] [-s <seed>] [-w]\n", prog);
+    exit(-1);
+}
+
+static double rate_arg(const char *name)
+{
+    double rate = atof(optarg);
+    if (rate<0 || rate>1.0) {
+	fprintf(stderr, "invalid <%s>\n", name);
+	exit(-1);
+    }
+    return rate;
+}
+
+/* run the sender in this process and the receiver in a child, with the
+   protocol in configuration "Config" */
+template <class Config>
+static int run(const LinkModel &link, uint64_t seed)
+{
+    typedef typename shm_transport<Config>::packet_type packet_type;
+    typedef shm_segment<packet_type> segment;
+
+    /* the segment is a memfd so that it could be handed to any process, the
+       receiver here simply inherits it */
+    int fd = memfd_create("rdt_shm", MFD_CLOEXEC);
+    if (fd<0 || ftruncate(fd, sizeof(segment))<0) {
+	fprintf(stderr, "cannot create shared memory: %s\n", strerror(errno));
+	exit(-1);
+    }
+    void *addr = mmap(NULL, sizeof(segment), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr==MAP_FAILED) {
+	fprintf(stderr, "cannot map shared memory: %s\n", strerror(errno));
+	exit(-1);
+    }
+    close(fd);
+    segment *seg = new (addr) segment();
+
+    int wake_sender = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    int wake_receiver = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (wake_sender<0 || wake_receiver<0) {
+	fprintf(stderr, "cannot create eventfd: %s\n", strerror(errno));
+	exit(-1);
+    }
+
+    shm_endpoint<packet_type> shm = {};
+    shm.origin = monotonic_ticks();
+    shm.deadline = -1;
+    shm.out = stdout;
+    shm.link = link;
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child<0) {
+	fprintf(stderr, "cannot fork: %s\n", strerror(errno));
+	exit(-1);
+    }
+    if (child==0) {
+	/* the receiver, with its own impairment stream */
+	shm.tx = &seg->to_sender;
+	shm.rx = &seg->to_receiver;
+	shm.wake_tx = wake_sender;
+	shm.rng = rng_seed(seed*2+1);
+	wake_rx = wake_receiver;
+	return run_receiver<Config>(seg, shm);
+    }
+
+    shm.tx = &seg->to_receiver;
+    shm.rx = &seg->to_sender;
+    shm.wake_tx = wake_receiver;
+    shm.rng = rng_seed(seed*2);
+    wake_rx = wake_sender;
+    int ret = run_sender<Config>(seg, shm, wake_receiver);
+
+    int status;
+    if (waitpid(child, &status, 0)<0 || !WIFEXITED(status)) {
+	fprintf(stderr, "the receiver failed\n");
+	exit(-1);
+    }
+    return ret ? ret : WEXITSTATUS(status);
+}
+
+int main(int argc, char *argv[])
+{
+    LinkModel link = {0, 0, 0, 0, 0};
+    uint64_t seed = time(NULL);
+    bool wide = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:c:s:w"))!=-1) {
+	switch (opt) {
+	case 'l':
+	    link.loss_rate = rate_arg("loss_rate");
+	    break;
+	case 'c':
+	    link.corrupt_rate = rate_arg("corrupt_rate");
+	    break;
+	case 's':
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'w':
+	    wide = true;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind!=argc) usage(argv[0]);
+
+    return wide ? run<rdt_wide_config>(link, seed) : run<rdt_quiet_config>(link, seed);
+}
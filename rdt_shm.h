@@ -0,0 +1,105 @@
+/*
+ * FILE: rdt_shm.h
+ * DESCRIPTION: Lock-free single-producer single-consumer packet rings in a
+ *              shared memory segment, for a sender and a receiver on the
+ *              same host (see rdt_shm_transport.h).
+ */
+
+
+#ifndef _RDT_SHM_H_
+#define _RDT_SHM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#include "rdt_struct.h"
+
+/* packets a ring holds, a power of 2 */
+#define SHM_RING_SLOTS	256
+
+#define CACHE_LINE	64
+
+/* one direction, of packets of type "Packet".  the producer owns "head", the
+   consumer "tail", each on its own cache line, so a packet costs the lines 
+   of its slot and one index transfer each way.  a consumer about to sleep
+   sets "waiting", and the producer then wakes it through an eventfd; a busy
+   consumer is never signalled. */
+template <class Packet>
+struct shm_ring
+{
+    alignas(CACHE_LINE) std::atomic<uint32_t> head;    /* next slot to fill */
+    alignas(CACHE_LINE) std::atomic<uint32_t> tail;    /* next slot to read */
+    alignas(CACHE_LINE) std::atomic<uint32_t> waiting; /* consumer sleeps */
+    alignas(CACHE_LINE) Packet slots[SHM_RING_SLOTS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+	      "ring indices are shared between processes");
+
+/* the shared segment: one ring per direction */
+template <class Packet>
+struct shm_segment
+{
+    shm_ring<Packet> to_receiver;
+    shm_ring<Packet> to_sender;
+    alignas(CACHE_LINE) std::atomic<uint32_t> closed; /* the sender is done */
+};
+
+/* the slot for the next packet, NULL if the ring is full.  fill it, then
+   publish it with ring_publish(). */
+template <class Packet>
+inline Packet *ring_reserve(shm_ring<Packet> &r)
+{
+    uint32_t head = r.head.load(std::memory_order_relaxed);
+    if (head-r.tail.load(std::memory_order_acquire)==SHM_RING_SLOTS)
+	return NULL;
+    return &r.slots[head%SHM_RING_SLOTS];
+}
+
+/* make the reserved slot visible to the consumer.  returns true if the
+   consumer is asleep and must be woken. */
+template <class Packet>
+inline bool ring_publish(shm_ring<Packet> &r)
+{
+    r.head.store(r.head.load(std::memory_order_relaxed)+1, std::memory_order_release);
+    /* pairs with the fence in ring_prepare_wait(): either the consumer sees
+       the packet or we see it waiting */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return r.waiting.load(std::memory_order_relaxed)!=0;
+}
+
+/* take the next packet into "pkt", false if the ring is empty */
+template <class Packet>
+inline bool ring_pop(shm_ring<Packet> &r, Packet *pkt)
+{
+    uint32_t tail = r.tail.load(std::memory_order_relaxed);
+    if (tail==r.head.load(std::memory_order_acquire))
+	return false;
+    memcpy(pkt, &r.slots[tail%SHM_RING_SLOTS], sizeof(Packet));
+    r.tail.store(tail+1, std::memory_order_release);
+    return true;
+}
+
+/* announce that the consumer is going to sleep.  returns false if packets
+   arrived meanwhile, it must not sleep then. */
+template <class Packet>
+inline bool ring_prepare_wait(shm_ring<Packet> &r)
+{
+    r.waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (r.tail.load(std::memory_order_relaxed)!=r.head.load(std::memory_order_relaxed)) {
+	r.waiting.store(0, std::memory_order_relaxed);
+	return false;
+    }
+    return true;
+}
+
+/* the consumer is awake again */
+template <class Packet>
+inline void ring_end_wait(shm_ring<Packet> &r)
+{
+    r.waiting.store(0, std::memory_order_relaxed);
+}
+
+#endif  /* _RDT_SHM_H_ */
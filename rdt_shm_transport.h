@@ -0,0 +1,90 @@
+/*
+ * FILE: rdt_shm_transport.h
+ * DESCRIPTION: Transport of the reliable data transfer sender and receiver
+ *              over a pair of rings in shared memory (see rdt_transport.h
+ *              and rdt_shm.h).
+ */
+
+#ifndef _RDT_SHM_TRANSPORT_H_
+#define _RDT_SHM_TRANSPORT_H_
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_transport.h"
+#include "rdt_link.h"
+#include "rdt_shm.h"
+
+
+/* the rings of packets of type "Packet", driven by the event loop of
+   rdt_shm.cc, which owns this state.  a packet is copied into a slot of the
+   peer's ring, the peer is woken through its eventfd only if it sleeps.
+   loss and corruption from "link" are applied to the slot on the way, a
+   packet that finds the ring full is lost as well. */
+template <class Packet>
+struct shm_endpoint {
+    shm_ring<Packet> *tx, *rx;  // rings to and from the peer
+    int wake_tx;                // eventfd the peer sleeps on
+    simtick_t origin;           // monotonic time at start
+    simtick_t deadline;         // expiry of the sender timer, -1 if stopped
+    FILE *out;                  // where delivered messages go
+    LinkModel link;             // injected impairments
+    uint64_t rng;
+    unsigned long sent, lost, corrupted, full, wakeups;
+};
+
+template <class Config>
+struct shm_transport {
+    typedef basic_packet<Config::packet_size> packet_type;
+
+    shm_endpoint<packet_type> *ep;
+    std::vector<packet_type *> pool;    // free packet buffers
+
+    explicit shm_transport(shm_endpoint<packet_type> *ep): ep(ep) {}
+
+    simtick_t now() const {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (simtick_t)ts.tv_sec * SIM_TICKS_PER_SEC + ts.tv_nsec - ep->origin;
+    }
+    packet_type *acquire() {
+        if (pool.empty()) return new packet_type;
+        packet_type *pkt = pool.back();
+        pool.pop_back();
+        return pkt;
+    }
+    void release(packet_type *pkt) { pool.push_back(pkt); }
+    void sender_send(packet_type *pkt) {
+        ep->sent++;
+        packet_type *slot = ring_reserve(*ep->tx);
+        if (slot == NULL) {
+            ep->full++;
+            return;
+        }
+        memcpy(slot->data, pkt->data, sizeof(packet_type));
+        if (ep->link.loss_rate > 0 || ep->link.corrupt_rate > 0) {
+            LinkFate fate = link_apply(ep->link, ep->rng, slot->data, sizeof(packet_type));
+            if (fate.lost) {
+                ep->lost++;
+                return;
+            }
+            if (fate.corrupted) ep->corrupted++;
+        }
+        if (ring_publish(*ep->tx)) {
+            uint64_t one = 1;
+            if (write(ep->wake_tx, &one, sizeof(one)) == sizeof(one)) ep->wakeups++;
+        }
+    }
+    void sender_send_buffer(packet_type *pkt) { sender_send(pkt); release(pkt); }
+    void start_timer(simtick_t timeout) { ep->deadline = now() + timeout; }
+    void stop_timer() { ep->deadline = -1; }
+    bool timer_set() const { return ep->deadline >= 0; }
+    void receiver_send_buffer(packet_type *pkt) { sender_send_buffer(pkt); }
+    void deliver(message *msg) { fwrite(msg->data, 1, msg->size, ep->out); }
+};
+
+#endif  /* _RDT_SHM_TRANSPORT_H_ */
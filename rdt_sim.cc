@@ -13,10 +13,20 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "rdt_struct.h"
 #include "rdt_sender.h"
 #include "rdt_receiver.h"
+#include "rdt_pcap.h"
+#include "rdt_link.h"
 
 
 /*[]------------------------------------------------------------------------[]
@@ -27,19 +37,35 @@
 class Event
 {
 public:
-    double sched_time;      /* scheduled occuring time */
+    simtick_t sched_time;   /* scheduled occuring time */
     int event_type;         /* application-specific event type */
+    int lp;                 /* logical process the event is delivered to */
+    simtick_t issue_time;   /* time at which the event was scheduled */
+    int src_lp;             /* logical process that scheduled the event */
+    unsigned long src_seq;  /* per-source schedule counter */
+    int flow;               /* flow the event belongs to */
     class Event *next;      /* next event in the chain */
 
 public:
-    Event() { next = NULL; }
+    Event() { next = NULL; lp = 0; issue_time = 0; src_lp = 0; src_seq = 0; flow = 0; }
+
+    /* strict total order of events.  simultaneous events are ordered by when 
+       and by whom they were scheduled rather than by insertion order, so the 
+       order seen by a logical process does not depend on how logical 
+       processes are interleaved. */
+    bool before(const Event *o) const {
+	if (sched_time!=o->sched_time) return sched_time<o->sched_time;
+	if (issue_time!=o->issue_time) return issue_time<o->issue_time;
+	if (src_lp!=o->src_lp) return src_lp<o->src_lp;
+	return src_seq<o->src_seq;
+    }
 };
 
 /* event chain class - the simulation core */
 class EventChain
 {
 public:
-    double sim_time;        /* simulation time */
+    simtick_t sim_time;     /* simulation time */
     Event *head;            /* head event in the chain */
 
 public:
@@ -48,16 +74,19 @@ public:
 	head = NULL;
     }
     
-    double time() { return sim_time; }
+    simtick_t time() { return sim_time; }
     
+    /* time of the next event, or a negative value if the chain is empty */
+    simtick_t next_time() { return head==NULL ? -1 : head->sched_time; }
+
     /* schedule an event - the event chain is maintained on an increasing order 
-       of sched_time */
+       of sched_time (see Event::before() for simultaneous events) */
     void schedule(Event *e) {
 	/* do nothing if the event is schedule for the past */
 	if (e->sched_time<sim_time) return;
 
 	Event **ppcur = &head;
-	while ((*ppcur!=NULL) && ((*ppcur)->sched_time<=e->sched_time))
+	while ((*ppcur!=NULL) && !e->before(*ppcur))
 	    ppcur = &((*ppcur)->next);
 
 	e->next = *ppcur;
@@ -86,12 +115,64 @@ public:
 };
 
 
+/* logical process - one independently simulated side of the link.  an LP only
+   touches its own state; everything it does to another LP goes through an 
+   event crossing the link, which takes at least the link lookahead. */
+class LogicalProcess
+{
+public:
+    int id;
+    EventChain *core;       /* chain holding this LP's pending events */
+    EventChain local;       /* private chain in parallel mode */
+    simtick_t now;          /* local simulation time */
+    unsigned long seq;      /* number of events scheduled so far */
+    uint64_t rng;           /* private random number stream */
+    std::vector<Event*> outbox;  /* events for other LPs, parallel mode */
+    int pkts_passed;        /* packets this LP put on the link */
+
+public:
+    LogicalProcess() {
+	id = 0;
+	core = &local;
+	now = 0;
+	seq = 0;
+	rng = 0;
+	pkts_passed = 0;
+    }
+};
+
+/* reusable thread barrier */
+class Barrier
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    int count, waiting;
+    unsigned long generation;
+
+public:
+    Barrier(int n) { count = n; waiting = 0; generation = 0; }
+
+    void wait() {
+	std::unique_lock<std::mutex> lock(mtx);
+	unsigned long gen = generation;
+	if (++waiting==count) {
+	    waiting = 0;
+	    generation++;
+	    cv.notify_all();
+	} else {
+	    cv.wait(lock, [&] { return gen!=generation; });
+	}
+    }
+};
+
+
 /*[]------------------------------------------------------------------------[]
   |  event definitions
   []------------------------------------------------------------------------[]*/
 
 enum {EVENT_SENDER_FROMUPPERLAYER=0, EVENT_SENDER_FROMLOWERLAYER, 
-      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER};
+      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER,
+      EVENT_BOTTLENECK_ARRIVAL};
 
 /* the event that the upper layer at the sender instructs rdt layer to send out 
    a message */
@@ -101,31 +182,68 @@ public:
     EventSenderFromUpperLayer() { event_type = EVENT_SENDER_FROMUPPERLAYER; }
 };
 
-/* the event that the lower layer at the sender informs the rdt layer that a 
-   packet is received from the link */
-class EventSenderFromLowerLayer : public Event
+/* the event that the timer at the sender expires */
+class EventSenderTimeout : public Event
 {
 public:
-    struct packet pkt;
-public:
-    EventSenderFromLowerLayer() { event_type = EVENT_SENDER_FROMLOWERLAYER; }
+    EventSenderTimeout() { event_type = EVENT_SENDER_TIMEOUT; }
 };
 
-/* the event that the timer at the sender expires */
-class EventSenderTimeout : public Event
+/* a packet buffer handed out by Packet_Acquire(), bound to the event that 
+   will carry it across the link */
+struct PacketBuffer
+{
+    struct packet pkt;          /* must be the first member */
+    class EventPacket *event;   /* the event this buffer belongs to */
+    PacketBuffer *next_free;    /* next buffer in the pool */
+};
+
+/* the event that the lower layer at the sender (EVENT_SENDER_FROMLOWERLAYER) 
+   or the receiver (EVENT_RECEIVER_FROMLOWERLAYER) informs the rdt layer that
+   a packet is received from the link.  on its way to the receiver the packet
+   may first arrive at the shared bottleneck (EVENT_BOTTLENECK_ARRIVAL).
+   the packet itself is the buffer the rdt layer filled in, so it is never 
+   copied between the rdt layer and the link. */
+class EventPacket : public Event
 {
 public:
-    EventSenderTimeout() { event_type = EVENT_SENDER_TIMEOUT; }
+    PacketBuffer buf;
+public:
+    EventPacket() { buf.event = this; buf.next_free = NULL; }
 };
 
-/* the event that the lower layer at the receiver informs the rdt layer that a 
-   packet is received from the link */
-class EventReceiverFromLowerLayer : public Event
+
+/*[]------------------------------------------------------------------------[]
+  |  flows
+  []------------------------------------------------------------------------[]*/
+
+/* one sender/receiver pair with its own upper layers */
+class Flow
 {
 public:
-    struct packet pkt;
+    int id;
+    int sender_lp;          /* LP of the sending side */
+    int receiver_lp;        /* LP of the receiving side */
+    struct sender_state *sender;
+    struct receiver_state *receiver;
+    Event *sender_timer;    /* sender timer event */
+    char send_cnt;          /* next character generated at the sender */
+    char recv_cnt;          /* next character expected at the receiver */
+    int chars_sent;
+    int chars_delivered;
+    bool message_verfication_passed;
+
 public:
-    EventReceiverFromLowerLayer() { event_type = EVENT_RECEIVER_FROMLOWERLAYER; }
+    Flow() {
+	id = 0;
+	sender_lp = receiver_lp = 0;
+	sender = NULL;
+	receiver = NULL;
+	sender_timer = NULL;
+	send_cnt = recv_cnt = 0;
+	chars_sent = chars_delivered = 0;
+	message_verfication_passed = true;
+    }
 };
 
 
@@ -135,6 +253,7 @@ public:
 
 /* total simulation time, the simulation will end at this time (in seconds) */
 double sim_time;
+simtick_t sim_ticks;
 
 /* average intervals between consecutive messages passed from the upper layer 
    at the sender (in seconds) */
@@ -145,12 +264,19 @@ int msg_size;
 
 /* average one-way packet delivery latency, set to be 100ms */
 const double pkt_latency = 0.1;
+const simtick_t pkt_latency_ticks = SIM_TICKS_PER_SEC/10;
 
 /* the probability that a packet is not delivered with the normal latency:
    a value of 0.1 means that one in ten packets are not delivered with the 
    normal latency */
 double outoforder_rate;
 
+/* lower bound of the latency of out-of-order packets (in seconds).  the 
+   default of 0 keeps the original model; parallel runs need a positive floor
+   since it bounds how far ahead the two sides may run. */
+double latency_floor = 0;
+simtick_t latency_floor_ticks = 0;
+
 /* packet loss probability: a value of 0.1 means that one in ten packets are
    lost on average */
 double loss_rate;
@@ -160,6 +286,9 @@ double loss_rate;
    packet can be corrupted */
 double corrupt_rate;
 
+/* the link model built from the parameters above */
+LinkModel link_model;
+
 /* tracing levels (higher level always prints out more information):
    a tracing level of 0 turns off all traces while a tracing, 
    a tracing level of 1 turns on regular traces,
@@ -167,89 +296,212 @@ double corrupt_rate;
 */
 int tracing_level;
 
-/* simulation event chain core */
+/* number of independent flows */
+int num_flows = 1;
+
+/* service rate of the bottleneck all flows' data packets share (in packets 
+   per second), 0 for no bottleneck */
+double bottleneck_rate = 0;
+simtick_t bottleneck_tx_ticks;  /* transmission time of one packet */
+
+/* number of packets the bottleneck can hold, 0 for an unlimited queue */
+int queue_limit = 0;
+
+/* number of worker threads, 0 runs the plain sequential event loop */
+int num_threads = 0;
+
+/* seed of the random number streams */
+unsigned int rand_seed;
+
+/* senders keep a single retransmission timer instead of one per packet */
+bool single_timer = false;
+
+/* senders infer losses from send times (RACK) instead of NAKs */
+bool loss_detection = false;
+
+/* payload size and ACK frequency the senders offer in their handshake, 0 
+   offers the protocol's default */
+int offer_mtu = 0;
+int offer_ack_freq = 0;
+
+/* senders offer the timestamp option */
+bool offer_timestamps = false;
+
+/* real-time pacing: simulated seconds per wall-clock second, 0 runs as fast 
+   as possible */
+double pace_speed = 0;
+
+/* capture of the packets crossing the link, enabled by a file name */
+const char *pcap_file = NULL;
+PcapWriter pcap;
+
+/* checkpointing: stop at "checkpoint_time" and write the state to 
+   "checkpoint_file", or resume from "restore_file", optionally reseeding the 
+   random number streams with "restore_seed" */
+simtick_t checkpoint_ticks = -1;
+const char *checkpoint_file = NULL;
+const char *restore_file = NULL;
+bool restore_reseed = false;
+unsigned int restore_seed;
+
+/* simulation event chain core, shared by all LPs in sequential mode */
 EventChain sim_core;
 
-/* sender timer event */
-Event *sender_timer = NULL;
+/* logical processes, the sending and the receiving side of every flow plus 
+   the bottleneck */
+std::vector<LogicalProcess> lps;
+int bottleneck_lp = -1;
+
+/* flows */
+std::vector<Flow> flows;
+
+/* the LP and flow whose event is being processed by this thread */
+static thread_local LogicalProcess *cur_lp = NULL;
+static thread_local Flow *cur_flow = NULL;
+
+/* bottleneck state, owned by the bottleneck LP */
+simtick_t bottleneck_busy = 0;  /* time the bottleneck becomes idle */
+int bottleneck_drops = 0;
 
 /* general statistics */
 int tot_chars_sent = 0;
 int tot_chars_delivered = 0;
 int tot_pkts_passed = 0;
 
-/* error flag set by message verification at the receiver */
-bool message_verfication_passed = true;
 
 
 /*[]------------------------------------------------------------------------[]
   |  simulation routines
   []------------------------------------------------------------------------[]*/
 
-/* generate a random number in [0,1] */
+/* generate a random number in [0,1) from the current LP's stream */
 static double myrandom()
 {
-    return(rand()*1.0/RAND_MAX);
+    return rng_uniform(cur_lp->rng);
+}
+
+/* convert seconds to simulation ticks */
+static simtick_t to_ticks(double seconds)
+{
+    return (simtick_t)(seconds*SIM_TICKS_PER_SEC + 0.5);
+}
+
+/* convert simulation ticks to seconds */
+static double to_seconds(simtick_t ticks)
+{
+    return ticks*1.0/SIM_TICKS_PER_SEC;
 }
 
+/* schedule an event for LP "dst" from the current LP */
+static void schedule_event(Event *e, int dst)
+{
+    LogicalProcess *lp = cur_lp;
+
+    e->lp = dst;
+    e->issue_time = lp->now;
+    e->src_lp = lp->id;
+    e->src_seq = lp->seq++;
+    e->flow = cur_flow->id;
+
+    if (num_threads>0 && dst!=lp->id)
+	lp->outbox.push_back(e);
+    else
+	lps[dst].core->schedule(e);
+}
+
+/* the '0'..'9' stream of generated messages.  "pattern_tile+cnt" holds 
+   PATTERN_SPAN characters of the stream starting at phase cnt, PATTERN_SPAN 
+   being a multiple of 10 copying a whole span keeps the phase. */
+#define PATTERN_SPAN 1020
+static char pattern_tile[10 + PATTERN_SPAN];
+
+static void init_pattern_tile()
+{
+    for (int i=0; i<10+PATTERN_SPAN; i++)
+	pattern_tile[i] = '0' + i%10;
+}
+
+/* write "len" characters of the '0'..'9' stream starting at phase "cnt" */
+static void pattern_fill(char *data, int len, int cnt)
+{
+    for (; len>PATTERN_SPAN; data+=PATTERN_SPAN, len-=PATTERN_SPAN)
+	memcpy(data, pattern_tile+cnt, PATTERN_SPAN);
+    memcpy(data, pattern_tile+cnt, len);
+}
+
+/* storage of generated messages.  a message is handed to the sender and not 
+   used anymore once Sender_FromUpperLayer() returns, so each thread reuses 
+   one buffer that only grows. */
+struct MessageArena
+{
+    struct message msg;
+    int capacity;
+};
+static thread_local MessageArena msg_arena;
+
 /* generate a message 
    NOTE: change this part if you want to generate different messages for 
          testing.  we will certainly use different messages in our grading! */
 static struct message *generate_msg()
 {
-    static char cnt = 0;
+    char &cnt = cur_flow->send_cnt;
 
-    struct message *msg = (struct message*) malloc(sizeof(struct message));
-    ASSERT(msg!=NULL);
+    struct message *msg = &msg_arena.msg;
     msg->size = (int)(myrandom()*2.0*msg_size);
     if (msg->size==0) msg->size=1;
-    msg->data = (char*) malloc(msg->size);
-    ASSERT(msg->data!=NULL);
-
-    for (int i=0; i<msg->size; i+=1) {
-	msg->data[i] = '0' + cnt;
-	cnt = (cnt+1) % 10;
+    if (msg->size>msg_arena.capacity) {
+	msg->data = (char*) realloc(msg->data, msg->size);
+	ASSERT(msg->data!=NULL);
+	msg_arena.capacity = msg->size;
     }
 
-    tot_chars_sent += msg->size;
+    pattern_fill(msg->data, msg->size, cnt);
+    cnt = (cnt + msg->size) % 10;
+
+    cur_flow->chars_sent += msg->size;
 
     return msg;
 }
 
-/* free the space of a message */
-static void free_msg(struct message *msg)
+/* get simulation time (in ticks) - for both the sender and the receiver */
+simtick_t GetSimulationTicks()
 {
-    if (msg->data!=NULL) free(msg->data);
-    if (msg!=NULL) free(msg);
+    return cur_lp->now;
 }
 
 /* get simulation time (in seconds) - for both the sender and the receiver */
 double GetSimulationTime()
 {
-    return sim_core.time();
+    return to_seconds(cur_lp->now);
 }
 
-/* start the sender timer with a specified timeout (in seconds).
+/* start the sender timer with a specified timeout (in seconds) */
+void Sender_StartTimer(double timeout)
+{
+    Sender_StartTimerTicks(to_ticks(timeout));
+}
+
+/* start the sender timer with a specified timeout (in ticks).
    the timer is cancelled with Sender_StopTimer() is called or a new 
    Sender_StartTimer() is called before the current timer expires.
    Sender_Timeout() will be called when the timer expires. */
-void Sender_StartTimer(double timeout)
+void Sender_StartTimerTicks(simtick_t timeout)
 {
     if (tracing_level>=1)
 	fprintf(stdout, "Time %.2fs (Sender): the timer is started (expires at %.2fs).\n",
-		sim_core.time(), sim_core.time() + timeout);
+		GetSimulationTime(), to_seconds(GetSimulationTicks() + timeout));
 
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
+    if (cur_flow->sender_timer!=NULL) {
+	cur_lp->core->cancel(cur_flow->sender_timer);
+	delete cur_flow->sender_timer;
+	cur_flow->sender_timer = NULL;
     }
 
     EventSenderTimeout *e = new EventSenderTimeout;
-    e->sched_time = sim_core.time() + timeout;
-    sim_core.schedule(e);
+    e->sched_time = GetSimulationTicks() + timeout;
+    schedule_event(e, cur_flow->sender_lp);
 
-    sender_timer = e;
+    cur_flow->sender_timer = e;
 }
 
 /* stop the sender timer */
@@ -257,12 +509,12 @@ void Sender_StopTimer()
 {
     if (tracing_level>=1)
 	fprintf(stdout, "Time %.2fs (Sender): the timer is stopped.\n", 
-		sim_core.time());
+		GetSimulationTime());
 
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
+    if (cur_flow->sender_timer!=NULL) {
+	cur_lp->core->cancel(cur_flow->sender_timer);
+	delete cur_flow->sender_timer;
+	cur_flow->sender_timer = NULL;
     }
 }
 
@@ -270,60 +522,115 @@ void Sender_StopTimer()
    return true if the timer is set, return false otherwise */
 bool Sender_isTimerSet()
 {
-    return (sender_timer!=NULL);
+    return (cur_flow->sender_timer!=NULL);
 }
 
-/* pass a packet to the lower layer at the sender */
-void Sender_ToLowerLayer(struct packet *pkt)
+/* free packet buffers of this thread.  a buffer may be released on another 
+   thread than it was acquired on, it then simply moves to that pool. */
+static thread_local PacketBuffer *packet_pool = NULL;
+
+/* get an empty packet buffer */
+struct packet *Packet_Acquire()
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
+    PacketBuffer *buf = packet_pool;
+    if (buf!=NULL)
+	packet_pool = buf->next_free;
+    else
+	buf = &(new EventPacket)->buf;
+    return &buf->pkt;
+}
 
-    EventReceiverFromLowerLayer *e = new EventReceiverFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+/* return a packet buffer to the pool */
+void Packet_Release(struct packet *pkt)
+{
+    PacketBuffer *buf = (PacketBuffer*) pkt;
+    buf->next_free = packet_pool;
+    packet_pool = buf;
+}
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
-	}
+/* the event carrying a packet buffer */
+static EventPacket *packet_event(struct packet *pkt)
+{
+    return ((PacketBuffer*) pkt)->event;
+}
+
+/* put a packet buffer on the link towards LP "dst" */
+static void link_transmit(struct packet *pkt, int event_type, int dst)
+{
+    int direction = (event_type==EVENT_SENDER_FROMLOWERLAYER) ? 
+	PCAP_TO_SENDER : PCAP_TO_RECEIVER;
+
+    LinkFate fate = link_apply(link_model, cur_lp->rng, pkt->data, RDT_PKTSIZE);
+    if (fate.lost) {
+	if (pcap_file!=NULL)
+	    pcap.write(GetSimulationTicks(), pkt, cur_flow->id, direction | PCAP_LOST);
+	Packet_Release(pkt);
+	return;
     }
+    if (fate.corrupted)
+	direction |= PCAP_CORRUPTED;
+    if (pcap_file!=NULL)
+	pcap.write(GetSimulationTicks(), pkt, cur_flow->id, direction);
 
     /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
+    EventPacket *e = packet_event(pkt);
+    e->event_type = event_type;
+    e->sched_time = GetSimulationTicks() + fate.latency;
+    schedule_event(e, dst);
+
+    cur_lp->pkts_passed ++;
+}
+
+/* pass a packet buffer to the lower layer at the sender */
+void Sender_ToLowerLayerBuffer(struct packet *pkt)
+{
+    if (bottleneck_lp>=0)
+	link_transmit(pkt, EVENT_BOTTLENECK_ARRIVAL, bottleneck_lp);
     else
-	e->sched_time = sim_core.time() + pkt_latency;
-    sim_core.schedule(e);
+	link_transmit(pkt, EVENT_RECEIVER_FROMLOWERLAYER, cur_flow->receiver_lp);
+}
 
-    tot_pkts_passed ++;
+/* pass a packet to the lower layer at the sender */
+void Sender_ToLowerLayer(struct packet *pkt)
+{
+    struct packet *buf = Packet_Acquire();
+    memcpy(buf->data, pkt->data, RDT_PKTSIZE);
+    Sender_ToLowerLayerBuffer(buf);
 }
 
+/* pass a packet buffer to the lower layer at the receiver */
+void Receiver_ToLowerLayerBuffer(struct packet *pkt)
+{
+    link_transmit(pkt, EVENT_SENDER_FROMLOWERLAYER, cur_flow->sender_lp);
+}
 
 /* pass a packet to the lower layer at the receiver */
 void Receiver_ToLowerLayer(struct packet *pkt)
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
-
-    EventSenderFromLowerLayer *e = new EventSenderFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+    struct packet *buf = Packet_Acquire();
+    memcpy(buf->data, pkt->data, RDT_PKTSIZE);
+    Receiver_ToLowerLayerBuffer(buf);
+}
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
-	}
+/* check whether "len" characters at "data" continue the '0'..'9' stream at 
+   phase "cnt" */
+static bool pattern_check(const char *data, int len, int cnt)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i+16<=len; i+=16) {
+	__m128i d = _mm_loadu_si128((const __m128i*)(data+i));
+	__m128i p = _mm_loadu_si128((const __m128i*)(pattern_tile+cnt));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, p))!=0xFFFF) return false;
+	cnt += 6;
+	if (cnt>=10) cnt -= 10;
     }
-
-    /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
-    else
-	e->sched_time = sim_core.time() + pkt_latency;	
-    sim_core.schedule(e);
-
-    tot_pkts_passed ++;
+#endif
+    for (; i<len; i++) {
+	if (data[i]!='0'+cnt) return false;
+	if (++cnt==10) cnt = 0;
+    }
+    return true;
 }
 
 /* deliver a message to the upper layer at the receiver 
@@ -331,36 +638,616 @@ void Receiver_ToLowerLayer(struct packet *pkt)
          generate_msg() for testing. */
 void Receiver_ToUpperLayer(struct message *msg)
 {
-    static char cnt = 0;
+    char &cnt = cur_flow->recv_cnt;
 
-    for (int i=0; i<msg->size; i++) {
-	/* message verification */
-	if (msg->data[i] != '0' + cnt) {
-	    message_verfication_passed = false;
+    /* message verification */
+    if (!pattern_check(msg->data, msg->size, cnt))
+	cur_flow->message_verfication_passed = false;
+    cnt = (cnt + msg->size) % 10;
+
+    if (tracing_level>=2)
+	fwrite(msg->data, 1, msg->size, stdout);
+
+    cur_flow->chars_delivered += msg->size;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main simulation control routine
+  []------------------------------------------------------------------------[]*/
+
+/* process one event on behalf of its LP */
+static void dispatch(Event *e)
+{
+    cur_lp = &lps[e->lp];
+    cur_lp->now = e->sched_time;
+    cur_flow = &flows[e->flow];
+    if (e->lp==cur_flow->sender_lp)
+	Sender_Select(cur_flow->sender);
+    else if (e->lp==cur_flow->receiver_lp)
+	Receiver_Select(cur_flow->receiver);
+
+    switch (e->event_type) {
+    case EVENT_SENDER_FROMUPPERLAYER:
+	{
+	    if (tracing_level>=1) {
+		fprintf(stdout, "Time %.2fs (Sender): the upper layer instructs rdt layer to send out a message.\n", GetSimulationTime());
+	    }
+
+	    EventSenderFromUpperLayer *real_e = (EventSenderFromUpperLayer*) e;
+
+	    /* the message stays in the arena, nothing to free */
+	    struct message *msg = generate_msg();
+	    Sender_FromUpperLayer(msg);
+
+	    /* schedule the recurring event */
+	    if (GetSimulationTicks() < sim_ticks) {
+		real_e->sched_time = 
+		    GetSimulationTicks() + to_ticks(msg_arrivalint*2.0*myrandom());
+		schedule_event(real_e, cur_flow->sender_lp);
+	    }
+	    else
+		delete real_e;
+	}
+	break;
+
+    case EVENT_SENDER_FROMLOWERLAYER:
+	{
+	    if (tracing_level>=1) {
+		fprintf(stdout, "Time %.2fs (Sender): the lower layer informs the rdt layer that a packet is received from the link.\n", GetSimulationTime());
+	    }
+
+	    EventPacket *real_e = (EventPacket*) e;
+
+	    Sender_FromLowerLayer(&real_e->buf.pkt);
+
+	    Packet_Release(&real_e->buf.pkt);
+	}
+	break;
+
+    case EVENT_SENDER_TIMEOUT:
+	{
+	    if (tracing_level>=1) {
+		fprintf(stdout, "Time %.2fs (Sender): the timer expires.\n", GetSimulationTime());
+	    }
+
+	    EventSenderTimeout *real_e = (EventSenderTimeout*) e;
+	    delete real_e;
+	    cur_flow->sender_timer = NULL;
+
+	    Sender_Timeout();
+	}
+	break;
+
+    case EVENT_RECEIVER_FROMLOWERLAYER:
+	{
+	    if (tracing_level>=1) {
+		fprintf(stdout, "Time %.2fs (Receiver): the lower layer informs the rdt layer that a packet is received from the link.\n", GetSimulationTime());
+	    }
+
+	    EventPacket *real_e = (EventPacket*) e;
+
+	    /* the receiver takes over the buffer */
+	    Receiver_AdoptFromLowerLayer(&real_e->buf.pkt);
+	}
+	break;
+
+    case EVENT_BOTTLENECK_ARRIVAL:
+	{
+	    /* FIFO queue served at "bottleneck_rate", the packet leaves for the 
+	       receiver once it is transmitted */
+	    EventPacket *real_e = (EventPacket*) e;
+	    simtick_t now = GetSimulationTicks();
+
+	    if (bottleneck_busy<now) bottleneck_busy = now;
+	    if (queue_limit>0 && 
+		bottleneck_busy-now>=queue_limit*bottleneck_tx_ticks) {
+		if (tracing_level>=1) {
+		    fprintf(stdout, "Time %.2fs (Bottleneck): queue full, packet of flow %d dropped.\n", GetSimulationTime(), e->flow);
+		}
+		bottleneck_drops ++;
+		if (pcap_file!=NULL)
+		    pcap.write(now, &real_e->buf.pkt, e->flow, 
+			       PCAP_TO_RECEIVER | PCAP_DROPPED);
+		Packet_Release(&real_e->buf.pkt);
+		break;
+	    }
+	    bottleneck_busy += bottleneck_tx_ticks;
+
+	    real_e->event_type = EVENT_RECEIVER_FROMLOWERLAYER;
+	    real_e->sched_time = bottleneck_busy;
+	    schedule_event(real_e, cur_flow->receiver_lp);
 	}
-	cnt = (cnt+1) % 10;
+	break;
 
-	if (tracing_level>=2)
-	    fputc(msg->data[i], stdout);
+    default:
+	fprintf(stderr, "undefined event %d\n", e->event_type);
+	break;
     }
+}
+
+/*[]------------------------------------------------------------------------[]
+  |  real-time pacing
+  []------------------------------------------------------------------------[]*/
 
-    tot_chars_delivered += msg->size;
+/* the wall-clock time simulation time "pace_origin_sim" maps to */
+static simtick_t pace_origin_wall, pace_origin_sim;
+
+/* how far the event loop fell behind the wall clock */
+static simtick_t pace_lag_max = 0;
+static double pace_lag_sum = 0;
+static unsigned long pace_waits = 0, pace_late = 0;
+
+/* an event counts as late once it runs this much after its wall-clock time */
+const simtick_t pace_late_ticks = SIM_TICKS_PER_SEC/1000;
+
+static simtick_t monotonic_ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (simtick_t) ts.tv_sec*SIM_TICKS_PER_SEC + ts.tv_nsec;
 }
 
+/* anchor simulation time "now" at the current wall-clock time */
+static void pace_start(simtick_t now)
+{
+    pace_origin_sim = now;
+    pace_origin_wall = monotonic_ticks();
+}
+
+/* sleep until simulation time "t" is due on the wall clock, and record the 
+   lag if it is already past */
+static void pace_until(simtick_t t)
+{
+    simtick_t target = pace_origin_wall + 
+	(simtick_t)((t-pace_origin_sim)/pace_speed);
+    simtick_t lag = monotonic_ticks()-target;
+
+    if (lag<0) {
+	struct timespec ts;
+	ts.tv_sec = target/SIM_TICKS_PER_SEC;
+	ts.tv_nsec = target%SIM_TICKS_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)!=0)
+	    ;
+	lag = 0;
+    }
+    pace_waits ++;
+    pace_lag_sum += lag;
+    if (lag>pace_lag_max) pace_lag_max = lag;
+    if (lag>=pace_late_ticks) pace_late ++;
+}
+
+/* sequential simulation: all LPs share one event chain */
+static void run_sequential()
+{
+    for (;;) {
+	simtick_t next = sim_core.next_time();
+	if (checkpoint_ticks>=0 && next>=checkpoint_ticks)
+	    break;
+	if (pace_speed>0 && next>=0)
+	    pace_until(next);
+	Event *e = sim_core.next_event();
+	if (e==NULL) break;
+	dispatch(e);
+    }
+}
+
+/* state shared by the worker threads of a parallel simulation */
+static simtick_t lookahead;
+static std::vector<simtick_t> worker_next;
+
+/* one worker of the parallel simulation.
+   conservative window-based synchronization: every event an LP sends to 
+   another LP is scheduled at least "lookahead" seconds ahead of the sender's
+   local time, so all events in [T, T+lookahead), T being the earliest pending
+   event of any LP, are safe to process without hearing from other LPs.  
+   after each window the events in flight are handed over and the next window
+   is computed.  since the event order within an LP is a total order and each
+   LP draws from its own random stream, the result is identical to a 
+   sequential run. */
+static void run_worker(int tid, Barrier *barrier)
+{
+    for (;;) {
+	/* earliest pending event of the LPs owned by this worker */
+	simtick_t next = -1;
+	for (int i=tid; i<(int)lps.size(); i+=num_threads) {
+	    simtick_t t = lps[i].core->next_time();
+	    if (t>=0 && (next<0 || t<next)) next = t;
+	}
+	worker_next[tid] = next;
+	barrier->wait();
+
+	simtick_t window_start = -1;
+	for (int i=0; i<num_threads; i++) {
+	    simtick_t t = worker_next[i];
+	    if (t>=0 && (window_start<0 || t<window_start)) window_start = t;
+	}
+	if (window_start<0) break;
+	if (checkpoint_ticks>=0 && window_start>=checkpoint_ticks) break;
+	simtick_t window_end = window_start + lookahead;
+	if (checkpoint_ticks>=0 && window_end>checkpoint_ticks)
+	    window_end = checkpoint_ticks;
+
+	/* paced runs hold the whole window until its start is due, the 
+	   events inside it run as fast as possible */
+	if (pace_speed>0) {
+	    if (tid==0) pace_until(window_start);
+	    barrier->wait();
+	}
+
+	/* process the safe events */
+	for (int i=tid; i<(int)lps.size(); i+=num_threads) {
+	    EventChain *core = lps[i].core;
+	    while (core->next_time()>=0 && core->next_time()<window_end)
+		dispatch(core->next_event());
+	}
+	barrier->wait();
+
+	/* pick up events sent to our LPs in one pass over all outboxes, the
+	   chains order them by Event::before() whatever the order they come in */
+	for (int j=0; j<(int)lps.size(); j++) {
+	    for (Event *e : lps[j].outbox)
+		if (e->lp%num_threads==tid) lps[e->lp].core->schedule(e);
+	}
+	barrier->wait();
+
+	for (int i=tid; i<(int)lps.size(); i+=num_threads)
+	    lps[i].outbox.clear();
+    }
+}
+
+/* parallel simulation: each LP has its own chain, LPs are spread over 
+   "num_threads" worker threads */
+static void run_parallel()
+{
+    lookahead = pkt_latency_ticks;
+    if (outoforder_rate>0 && latency_floor_ticks<lookahead)
+	lookahead = latency_floor_ticks;
+    /* a packet spends at least its transmission time in the bottleneck */
+    if (bottleneck_lp>=0 && bottleneck_tx_ticks<lookahead)
+	lookahead = bottleneck_tx_ticks;
+
+    Barrier barrier(num_threads);
+    std::vector<std::thread> workers;
+    worker_next.assign(num_threads, -1);
+    for (int i=1; i<num_threads; i++)
+	workers.emplace_back(run_worker, i, &barrier);
+    run_worker(0, &barrier);
+    for (auto &w : workers)
+	w.join();
+
+    /* the clock shown at the end is the latest of the LP clocks */
+    for (int i=0; i<(int)lps.size(); i++)
+	if (lps[i].now>sim_core.sim_time) sim_core.sim_time = lps[i].now;
+}
 
 /*[]------------------------------------------------------------------------[]
-  |  main simulation control routine
+  |  checkpoints
   []------------------------------------------------------------------------[]*/
 
-int main(int argc, char *argv[])
+/* a checkpoint holds the complete simulation state between two events: LP 
+   clocks and random streams, flow statistics, all pending events and the 
+   state of every sender and receiver.  it is written in host layout and only
+   meant to be read back by the same build. */
+static const char checkpoint_magic[8] = {'R','D','T','C','K','P','T','2'};
+
+template <typename T>
+static void ckpt_put(FILE *fp, const T &v)
+{
+    if (fwrite(&v, sizeof(T), 1, fp)!=1) {
+	fprintf(stderr, "error writing checkpoint\n");
+	exit(-1);
+    }
+}
+
+template <typename T>
+static void ckpt_get(FILE *fp, T &v)
+{
+    if (fread(&v, sizeof(T), 1, fp)!=1) {
+	fprintf(stderr, "error reading checkpoint\n");
+	exit(-1);
+    }
+}
+
+static bool is_packet_event(int event_type)
+{
+    return event_type==EVENT_SENDER_FROMLOWERLAYER || 
+	event_type==EVENT_RECEIVER_FROMLOWERLAYER ||
+	event_type==EVENT_BOTTLENECK_ARRIVAL;
+}
+
+/* number of pending events */
+static uint32_t count_events()
+{
+    uint32_t n = 0;
+    if (num_threads>0) {
+	for (LogicalProcess &lp : lps)
+	    for (Event *e = lp.local.head; e!=NULL; e = e->next) n++;
+    } else {
+	for (Event *e = sim_core.head; e!=NULL; e = e->next) n++;
+    }
+    return n;
+}
+
+static void save_event(FILE *fp, Event *e)
+{
+    ckpt_put(fp, e->event_type);
+    ckpt_put(fp, e->lp);
+    ckpt_put(fp, e->flow);
+    ckpt_put(fp, e->sched_time);
+    ckpt_put(fp, e->issue_time);
+    ckpt_put(fp, e->src_lp);
+    ckpt_put(fp, e->src_seq);
+    if (is_packet_event(e->event_type))
+	ckpt_put(fp, ((EventPacket*) e)->buf.pkt);
+}
+
+static void save_checkpoint(const char *path)
 {
-    if (argc!=8) {
-	fprintf(stderr, "usage: %s <sim_time> <mean_msg_arrivalint> <mean_msg_size> "
-		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n", 
-		argv[0]);
+    FILE *fp = fopen(path, "wb");
+    if (fp==NULL) {
+	fprintf(stderr, "cannot open checkpoint %s\n", path);
 	exit(-1);
     }
 
+    ckpt_put(fp, checkpoint_magic);
+    ckpt_put(fp, num_flows);
+    ckpt_put(fp, bottleneck_lp);
+    ckpt_put(fp, sim_core.sim_time);
+    for (LogicalProcess &lp : lps) {
+	ckpt_put(fp, lp.now);
+	ckpt_put(fp, lp.seq);
+	ckpt_put(fp, lp.rng);
+	ckpt_put(fp, lp.pkts_passed);
+    }
+    ckpt_put(fp, bottleneck_busy);
+    ckpt_put(fp, bottleneck_drops);
+    for (Flow &f : flows) {
+	ckpt_put(fp, f.send_cnt);
+	ckpt_put(fp, f.recv_cnt);
+	ckpt_put(fp, f.chars_sent);
+	ckpt_put(fp, f.chars_delivered);
+	ckpt_put(fp, f.message_verfication_passed);
+    }
+
+    ckpt_put(fp, count_events());
+    if (num_threads>0) {
+	for (LogicalProcess &lp : lps)
+	    for (Event *e = lp.local.head; e!=NULL; e = e->next) save_event(fp, e);
+    } else {
+	for (Event *e = sim_core.head; e!=NULL; e = e->next) save_event(fp, e);
+    }
+
+    for (Flow &f : flows) {
+	cur_flow = &f;
+	cur_lp = &lps[f.sender_lp];
+	Sender_Select(f.sender);
+	bool ok = Sender_Save(fp);
+	cur_lp = &lps[f.receiver_lp];
+	Receiver_Select(f.receiver);
+	if (!ok || !Receiver_Save(fp)) {
+	    fprintf(stderr, "error writing checkpoint\n");
+	    exit(-1);
+	}
+    }
+
+    if (fclose(fp)!=0) {
+	fprintf(stderr, "error writing checkpoint\n");
+	exit(-1);
+    }
+}
+
+/* resume from a checkpoint, in place of initializing the flows */
+static void restore_checkpoint(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp==NULL) {
+	fprintf(stderr, "cannot open checkpoint %s\n", path);
+	exit(-1);
+    }
+
+    char magic[8];
+    int saved_flows, saved_bottleneck_lp;
+    ckpt_get(fp, magic);
+    ckpt_get(fp, saved_flows);
+    ckpt_get(fp, saved_bottleneck_lp);
+    if (memcmp(magic, checkpoint_magic, sizeof(magic))!=0) {
+	fprintf(stderr, "%s is not a checkpoint\n", path);
+	exit(-1);
+    }
+    if (saved_flows!=num_flows || saved_bottleneck_lp!=bottleneck_lp) {
+	fprintf(stderr, "checkpoint %s was taken with a different number of flows "
+		"or bottleneck setting\n", path);
+	exit(-1);
+    }
+
+    ckpt_get(fp, sim_core.sim_time);
+    for (LogicalProcess &lp : lps) {
+	ckpt_get(fp, lp.now);
+	ckpt_get(fp, lp.seq);
+	ckpt_get(fp, lp.rng);
+	ckpt_get(fp, lp.pkts_passed);
+	lp.local.sim_time = lp.now;
+	/* forking sweep points off one checkpoint with different seeds */
+	if (restore_reseed)
+	    lp.rng = rng_seed(((uint64_t)restore_seed<<32) + lp.id);
+    }
+    ckpt_get(fp, bottleneck_busy);
+    ckpt_get(fp, bottleneck_drops);
+    for (Flow &f : flows) {
+	ckpt_get(fp, f.send_cnt);
+	ckpt_get(fp, f.recv_cnt);
+	ckpt_get(fp, f.chars_sent);
+	ckpt_get(fp, f.chars_delivered);
+	ckpt_get(fp, f.message_verfication_passed);
+    }
+
+    uint32_t num_events;
+    ckpt_get(fp, num_events);
+    for (uint32_t i=0; i<num_events; i++) {
+	int event_type;
+	ckpt_get(fp, event_type);
+
+	Event *e;
+	if (is_packet_event(event_type)) {
+	    e = packet_event(Packet_Acquire());
+	} else if (event_type==EVENT_SENDER_FROMUPPERLAYER) {
+	    e = new EventSenderFromUpperLayer;
+	} else if (event_type==EVENT_SENDER_TIMEOUT) {
+	    e = new EventSenderTimeout;
+	} else {
+	    fprintf(stderr, "undefined event %d in checkpoint\n", event_type);
+	    exit(-1);
+	}
+	e->event_type = event_type;
+	ckpt_get(fp, e->lp);
+	ckpt_get(fp, e->flow);
+	ckpt_get(fp, e->sched_time);
+	ckpt_get(fp, e->issue_time);
+	ckpt_get(fp, e->src_lp);
+	ckpt_get(fp, e->src_seq);
+	if (is_packet_event(event_type))
+	    ckpt_get(fp, ((EventPacket*) e)->buf.pkt);
+	if (e->lp<0 || e->lp>=(int)lps.size() || e->flow<0 || e->flow>=num_flows) {
+	    fprintf(stderr, "corrupted checkpoint %s\n", path);
+	    exit(-1);
+	}
+	if (event_type==EVENT_SENDER_TIMEOUT)
+	    flows[e->flow].sender_timer = e;
+	lps[e->lp].core->schedule(e);
+    }
+
+    for (Flow &f : flows) {
+	cur_flow = &f;
+	cur_lp = &lps[f.sender_lp];
+	Sender_Select(f.sender);
+	bool ok = Sender_Restore(fp);
+	cur_lp = &lps[f.receiver_lp];
+	Receiver_Select(f.receiver);
+	if (!ok || !Receiver_Restore(fp)) {
+	    fprintf(stderr, "error reading checkpoint\n");
+	    exit(-1);
+	}
+    }
+
+    fclose(fp);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n <flows>] [-b <bottleneck_rate>] [-q <queue_limit>] "
+	    "[-j <threads>] [-f <latency_floor>] [-s <seed>] [-t <speed>] [-T] [-L] "
+	    "[-m <mtu>] [-a <ack_freq>] [-e] "
+	    "[-p <pcap_file>] [-c <checkpoint_time> -w <checkpoint_file>] [-r <checkpoint_file> [-R <seed>]] "
+	    "<sim_time> <mean_msg_arrivalint> <mean_msg_size> "
+	    "<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n", 
+	    prog);
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    rand_seed = getpid()+getppid();
+
+    int opt;
+    double checkpoint_time = -1;
+    while ((opt = getopt(argc, argv, "n:b:q:j:f:s:t:TLm:a:ep:c:w:r:R:"))!=-1) {
+	switch (opt) {
+	case 'n':
+	    num_flows = atoi(optarg);
+	    if (num_flows<=0) {
+		fprintf(stderr, "invalid <flows>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'b':
+	    bottleneck_rate = atof(optarg);
+	    if (bottleneck_rate<0) {
+		fprintf(stderr, "invalid <bottleneck_rate>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'q':
+	    queue_limit = atoi(optarg);
+	    if (queue_limit<0) {
+		fprintf(stderr, "invalid <queue_limit>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'j':
+	    num_threads = atoi(optarg);
+	    if (num_threads<0) {
+		fprintf(stderr, "invalid <threads>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'f':
+	    latency_floor = atof(optarg);
+	    if (latency_floor<0 || latency_floor>pkt_latency) {
+		fprintf(stderr, "invalid <latency_floor>\n");
+		exit(-1);
+	    }
+	    break;
+	case 's':
+	    rand_seed = strtoul(optarg, NULL, 0);
+	    break;
+	case 't':
+	    pace_speed = atof(optarg);
+	    if (pace_speed<0) {
+		fprintf(stderr, "invalid <speed>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'T':
+	    single_timer = true;
+	    break;
+	case 'L':
+	    loss_detection = true;
+	    break;
+	case 'm':
+	    offer_mtu = atoi(optarg);
+	    if (offer_mtu<1 || offer_mtu>RDT_PKTSIZE) {
+		fprintf(stderr, "invalid <mtu>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'e':
+	    offer_timestamps = true;
+	    break;
+	case 'a':
+	    offer_ack_freq = atoi(optarg);
+	    if (offer_ack_freq<1) {
+		fprintf(stderr, "invalid <ack_freq>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'p':
+	    pcap_file = optarg;
+	    break;
+	case 'c':
+	    checkpoint_time = atof(optarg);
+	    if (checkpoint_time<0) {
+		fprintf(stderr, "invalid <checkpoint_time>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'w':
+	    checkpoint_file = optarg;
+	    break;
+	case 'r':
+	    restore_file = optarg;
+	    break;
+	case 'R':
+	    restore_seed = strtoul(optarg, NULL, 0);
+	    restore_reseed = true;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (argc-optind!=7) usage(argv[0]);
+    argv += optind-1;
+
     sim_time = atof(argv[1]);
     if (sim_time<=0) {
 	fprintf(stderr, "invalid <sim_time>\n");
@@ -396,6 +1283,27 @@ int main(int argc, char *argv[])
 	fprintf(stderr, "invalid <tracing_level>\n");
 	exit(-1);
     }
+    if ((checkpoint_time>=0)!=(checkpoint_file!=NULL)) {
+	fprintf(stderr, "-c and -w go together\n");
+	exit(-1);
+    }
+    if (checkpoint_time>=0) checkpoint_ticks = to_ticks(checkpoint_time);
+    sim_ticks = to_ticks(sim_time);
+    latency_floor_ticks = to_ticks(latency_floor);
+    link_model.loss_rate = loss_rate;
+    link_model.corrupt_rate = corrupt_rate;
+    link_model.outoforder_rate = outoforder_rate;
+    link_model.latency = pkt_latency_ticks;
+    link_model.latency_floor = latency_floor_ticks;
+    if (bottleneck_rate>0) {
+	bottleneck_tx_ticks = to_ticks(1.0/bottleneck_rate);
+	if (bottleneck_tx_ticks<1) bottleneck_tx_ticks = 1;
+    }
+    if (num_threads>0 && outoforder_rate>0 && latency_floor_ticks<=0) {
+	fprintf(stderr, "parallel simulation needs a positive <latency_floor> "
+		"when packets may be reordered\n");
+	exit(-1);
+    }
     
     fprintf(stdout, "## Reliable data transfer simulation with:\n"
 	    "\tsimulation time is %.3f seconds\n"
@@ -404,19 +1312,58 @@ int main(int argc, char *argv[])
 	    "\taverage out-of-order delivery rate is %.2f%%\n"
 	    "\taverage loss rate is %.2f%%\n"
 	    "\taverage corrupt rate is %.2f%%\n"
-	    "\ttracing level is %d\n"
-	    "Please review these inputs and press <enter> to proceed.\n",
+	    "\ttracing level is %d\n",
 	    sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0, 
 	    loss_rate*100.0, corrupt_rate*100.0, tracing_level);
+    if (num_flows>1)
+	fprintf(stdout, "\tnumber of flows is %d\n", num_flows);
+    if (bottleneck_rate>0)
+	fprintf(stdout, "\tbottleneck rate is %.1f packets/s, queue limit is %d packets\n",
+		bottleneck_rate, queue_limit);
+    if (single_timer)
+	fprintf(stdout, "\tsenders use a single retransmission timer\n");
+    if (loss_detection)
+	fprintf(stdout, "\tsenders use time-based loss detection\n");
+    if (offer_mtu>0)
+	fprintf(stdout, "\tsenders offer a payload size of %d bytes\n", offer_mtu);
+    if (offer_ack_freq>0)
+	fprintf(stdout, "\tsenders offer one ACK per %d packets\n", offer_ack_freq);
+    if (offer_timestamps)
+	fprintf(stdout, "\tsenders offer the timestamp option\n");
+    if (pace_speed>0)
+	fprintf(stdout, "\tpaced at %.2f times real time\n", pace_speed);
+    fprintf(stdout, "Please review these inputs and press <enter> to proceed.\n");
     fgetc(stdin);
 
-    /* initialize the random number generator */
-    srand(getpid()+getppid());
+    /* set up the flows and the LPs they run on */
+    flows.resize(num_flows);
+    lps.resize(2*num_flows);
+    if (bottleneck_rate>0) {
+	bottleneck_lp = lps.size();
+	lps.resize(lps.size()+1);
+    }
+    for (int i=0; i<num_flows; i++) {
+	flows[i].id = i;
+	flows[i].sender_lp = 2*i;
+	flows[i].receiver_lp = 2*i+1;
+	flows[i].sender = Sender_Create();
+	flows[i].receiver = Receiver_Create();
+    }
+
+    init_pattern_tile();
+
+    /* initialize the random number streams, one per LP */
+    for (int i=0; i<(int)lps.size(); i++) {
+	lps[i].id = i;
+	lps[i].rng = rng_seed(((uint64_t)rand_seed<<32) + i);
+	lps[i].core = (num_threads>0) ? &lps[i].local : &sim_core;
+    }
 
     /* test the random number generator */
+    uint64_t randtest_state = rng_seed(rand_seed);
     double randtest_sum = 0.0;
     for (int i=0; i<1000; i++)
-	randtest_sum += myrandom();
+	randtest_sum += rng_uniform(randtest_state);
     double randtest_avg = randtest_sum/1000;
     if (randtest_avg<0.25 || randtest_avg>0.75) {
 	fprintf(stderr, 
@@ -426,102 +1373,126 @@ int main(int argc, char *argv[])
 	exit(-1);
     }
 
-    /* intialize the sender and the receiver */
-    Sender_Init();
-    Receiver_Init();
-
-    /* scheduling a recurring message arrival event */
-    EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
-    e->sched_time = 0;
-    sim_core.schedule(e);
-
-    /* main simulation cycle */
-    for (;;) {
-	Event *e = sim_core.next_event();
-	if (e==NULL) break;
-
-	switch (e->event_type) {
-	case EVENT_SENDER_FROMUPPERLAYER:
-	    {
-		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Sender): the upper layer instructs rdt layer to send out a message.\n", sim_core.time());
-		}
-
-		EventSenderFromUpperLayer *real_e = (EventSenderFromUpperLayer*) e;
-
-		struct message *msg = generate_msg();
-		Sender_FromUpperLayer(msg);
-		free_msg(msg);
-
-		/* schedule the recurring event */
-		if (sim_core.time() < sim_time) {
-		    real_e->sched_time = 
-			sim_core.time() + msg_arrivalint*2.0*myrandom();
-		    sim_core.schedule(real_e);
-		}
-		else
-		    delete real_e;
-	    }
-	    break;
-
-	case EVENT_SENDER_FROMLOWERLAYER:
-	    {
-		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Sender): the lower layer informs the rdt layer that a packet is received from the link.\n", sim_core.time());
-		}
-
-		EventSenderFromLowerLayer *real_e = (EventSenderFromLowerLayer*) e;
-
-		Sender_FromLowerLayer(&real_e->pkt);
-
-		delete real_e;
-	    }
-	    break;
-
-	case EVENT_SENDER_TIMEOUT:
-	    {
-		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Sender): the timer expires.\n", sim_core.time());
-		}
-
-		EventSenderTimeout *real_e = (EventSenderTimeout*) e;
-		delete real_e;
-		sender_timer = NULL;
+    if (pcap_file!=NULL && !pcap.open(pcap_file)) {
+	fprintf(stderr, "cannot open %s\n", pcap_file);
+	exit(-1);
+    }
 
-		Sender_Timeout();
-	    }
-	    break;
+    if (restore_file!=NULL)
+	restore_checkpoint(restore_file);
+    else for (Flow &f : flows) {
+	cur_flow = &f;
+
+	/* intialize the sender and the receiver */
+	cur_lp = &lps[f.sender_lp];
+	Sender_Select(f.sender);
+	Sender_SetSingleTimer(single_timer);
+	Sender_SetLossDetection(loss_detection);
+	Sender_SetOffer(0, offer_mtu, offer_ack_freq, offer_timestamps);
+	Sender_Init();
+	cur_lp = &lps[f.receiver_lp];
+	Receiver_Select(f.receiver);
+	Receiver_Init();
+
+	/* scheduling a recurring message arrival event */
+	cur_lp = &lps[f.sender_lp];
+	EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
+	e->sched_time = 0;
+	schedule_event(e, f.sender_lp);
+    }
 
-	case EVENT_RECEIVER_FROMLOWERLAYER:
-	    {
-		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Receiver): the lower layer informs the rdt layer that a packet is received from the link.\n", sim_core.time());
-		}
+    /* main simulation cycle, paced from the earliest LP clock on */
+    if (pace_speed>0) {
+	simtick_t start = lps[0].now;
+	for (int i=1; i<(int)lps.size(); i++)
+	    if (lps[i].now<start) start = lps[i].now;
+	pace_start(start);
+    }
+    if (num_threads>0)
+	run_parallel();
+    else
+	run_sequential();
 
-		EventReceiverFromLowerLayer *real_e = (EventReceiverFromLowerLayer*) e;
-		
-		Receiver_FromLowerLayer(&real_e->pkt);
+    if (pcap_file!=NULL)
+	pcap.close();
 
-		delete real_e;
-	    }
-	    break;
-
-	default:
-	    fprintf(stderr, "undefined event %d\n", e->event_type);
-	    break;
-	}
+    /* stopped at the checkpoint with events left */
+    if (checkpoint_ticks>=0 && count_events()>0) {
+	save_checkpoint(checkpoint_file);
+	fprintf(stdout, "\n## Checkpoint taken at time %.2fs, written to %s\n",
+		to_seconds(checkpoint_ticks), checkpoint_file);
+	return 0;
     }
 
     /* finalize the sender and the receiver */
-    Sender_Final();
-    Receiver_Final();
+    bool message_verfication_passed = true;
+    struct sender_stats tot_stats = {};
+    for (Flow &f : flows) {
+	cur_flow = &f;
+	cur_lp = &lps[f.sender_lp];
+	Sender_Select(f.sender);
+	Sender_Final();
+	struct sender_stats st;
+	Sender_GetStats(&st);
+	tot_stats.sent += st.sent;
+	tot_stats.retransmitted += st.retransmitted;
+	tot_stats.retx_bytes += st.retx_bytes;
+	tot_stats.spurious += st.spurious;
+	tot_stats.spurious_bytes += st.spurious_bytes;
+	tot_stats.acked += st.acked;
+	tot_stats.ack_delay += st.ack_delay;
+	Sender_Destroy(f.sender);
+	cur_lp = &lps[f.receiver_lp];
+	Receiver_Select(f.receiver);
+	Receiver_Final();
+	Receiver_Destroy(f.receiver);
+
+	tot_chars_sent += f.chars_sent;
+	tot_chars_delivered += f.chars_delivered;
+	if (!f.message_verfication_passed || f.chars_sent!=f.chars_delivered)
+	    message_verfication_passed = false;
+    }
+
+    for (int i=0; i<(int)lps.size(); i++)
+	tot_pkts_passed += lps[i].pkts_passed;
 
     fprintf(stdout, "\n");
     fprintf(stdout, "## Simulation completed at time %.2fs with\n" 
 	    "\t%d characters sent\n" 
 	    "\t%d characters delivered\n"
 	    "\t%d packets passed between the sender and the receiver\n", 
-	    sim_core.time(), tot_chars_sent, tot_chars_delivered, tot_pkts_passed);
+	    to_seconds(sim_core.time()), tot_chars_sent, tot_chars_delivered, tot_pkts_passed);
+    if (bottleneck_lp>=0)
+	fprintf(stdout, "\t%d packets dropped at the bottleneck\n", bottleneck_drops);
+    fprintf(stdout, "## Retransmissions: %lu data packets sent, %lu resent "
+	    "(%lu bytes), %lu of them spurious (%lu bytes wasted)\n",
+	    tot_stats.sent, tot_stats.retransmitted, tot_stats.retx_bytes,
+	    tot_stats.spurious, tot_stats.spurious_bytes);
+    if (tot_stats.acked>0)
+	fprintf(stdout, "\tfirst transmission to acknowledgement %.3fms on average\n",
+		tot_stats.ack_delay/1e6/tot_stats.acked);
+    if (pace_speed>0 && pace_waits>0)
+	fprintf(stdout, "## Real-time pacing: lag behind the wall clock %.3fms on average, "
+		"%.3fms at most, %lu of %lu steps late by 1ms or more\n",
+		pace_lag_sum/pace_waits/1e6, pace_lag_max/1e6, pace_late, pace_waits);
+
+    if (num_flows>1) {
+	/* goodput of a flow: characters delivered over <sim_time>, the time
+	   messages are generated in, the same for every flow */
+	double sum = 0, sum_sq = 0;
+	fprintf(stdout, "## Per-flow statistics:\n");
+	for (Flow &f : flows) {
+	    double goodput = f.chars_delivered/sim_time;
+	    sum += goodput;
+	    sum_sq += goodput*goodput;
+	    fprintf(stdout, "\tflow %d: %d characters sent, %d delivered, "
+		    "goodput %.2f bytes/s over sim_time %.2fs%s\n", f.id, f.chars_sent,
+		    f.chars_delivered, goodput, sim_time,
+		    f.message_verfication_passed ? "" : ", verification FAILED");
+	}
+	fprintf(stdout, "\tJain's fairness index is %.4f\n", 
+		sum_sq>0 ? sum*sum/(num_flows*sum_sq) : 1.0);
+    }
 
     if (message_verfication_passed && (tot_chars_sent==tot_chars_delivered))
 	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
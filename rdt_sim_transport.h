@@ -0,0 +1,46 @@
+/*
+ * FILE: rdt_sim_transport.h
+ * DESCRIPTION: Transport of the reliable data transfer sender and receiver
+ *              over the simulator (see rdt_transport.h).
+ */
+
+#ifndef _RDT_SIM_TRANSPORT_H_
+#define _RDT_SIM_TRANSPORT_H_
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_transport.h"
+#include "rdt_utils.h"
+
+
+/* the configuration the simulator's sender and receiver are built for, 
+   -DRDT_CONFIG=<type> (make RDT_CONFIG=<type>) picks another one */
+#ifndef RDT_CONFIG
+#define RDT_CONFIG rdt_default_config
+#endif
+typedef RDT_CONFIG rdt_config;
+
+/* the simulator (rdt_sim.cc), resolved at link time.  its packets are of a
+   fixed size, the configuration must fill them exactly. */
+template <class Config>
+struct sim_transport {
+    typedef basic_packet<RDT_PKTSIZE> packet_type;
+    static_assert(Config::packet_size == RDT_PKTSIZE,
+                  "the simulator carries packets of RDT_PKTSIZE bytes");
+
+    static packet *raw(packet_type *pkt) { return (packet *)pkt; }
+
+    simtick_t now() const { return GetSimulationTicks(); }
+    packet_type *acquire() { return (packet_type *)Packet_Acquire(); }
+    void release(packet_type *pkt) { Packet_Release(raw(pkt)); }
+    void sender_send(packet_type *pkt) { Sender_ToLowerLayer(raw(pkt)); }
+    void sender_send_buffer(packet_type *pkt) { Sender_ToLowerLayerBuffer(raw(pkt)); }
+    void start_timer(simtick_t timeout) { Sender_StartTimerTicks(timeout); }
+    void stop_timer() { Sender_StopTimer(); }
+    bool timer_set() const { return Sender_isTimerSet(); }
+    void receiver_send_buffer(packet_type *pkt) { Receiver_ToLowerLayerBuffer(raw(pkt)); }
+    void deliver(message *msg) { Receiver_ToUpperLayer(msg); }
+};
+
+#endif  /* _RDT_SIM_TRANSPORT_H_ */
@@ -8,6 +8,8 @@
 #ifndef _RDT_STRUCT_H_
 #define _RDT_STRUCT_H_
 
+#include <stdint.h>
+
 /* sanity check utility */
 #define ASSERT(x) \
     if (!(x)) { \
@@ -30,4 +32,9 @@ struct packet {
     char data[RDT_PKTSIZE];
 };
 
+/* simulation time is kept in integer ticks of one nanosecond */
+typedef int64_t simtick_t;
+
+#define SIM_TICKS_PER_SEC 1000000000LL
+
 #endif  /* _RDT_STRUCT_H_ */
@@ -0,0 +1,44 @@
+/*
+ * FILE: rdt_transport.h
+ * DESCRIPTION: Lower layer of the reliable data transfer sender and 
+ *              receiver.
+ *
+ * The protocol reaches its lower layer, its timer and its clock only through
+ * a transport object it holds, whose type is a parameter of the sender and
+ * receiver templates (rdt_basic_sender.h, rdt_basic_receiver.h).  Transports
+ * are defined in full in headers of their own, so their calls inline into
+ * the hot paths of the protocol, and several kinds can be instantiated in 
+ * one binary:
+ *
+ *   rdt_sim_transport.h        the simulator (rdt_sim.cc)
+ *   rdt_udp_transport.h        a UDP socket (rdt_udp.cc)
+ *   rdt_shm_transport.h        rings in shared memory (rdt_shm.cc)
+ *
+ * A transport provides:
+ *   packet_type                its packet buffer, a basic_packet of the 
+ *                              configuration's packet size
+ *   now()                      current time, in ticks
+ *   acquire(), release(pkt)    packet buffers
+ *   sender_send(pkt)           put a copy of "pkt" on the link
+ *   sender_send_buffer(pkt)    put an acquired buffer on the link, the
+ *                              transport takes it over
+ *   start_timer(ticks), stop_timer(), timer_set()
+ *                              the one-shot sender timer, the sender's 
+ *                              Timeout() is to be called when it expires
+ *   receiver_send_buffer(pkt)  as sender_send_buffer(), at the receiver
+ *   deliver(msg)               hand a message to the upper layer
+ */
+
+#ifndef _RDT_TRANSPORT_H_
+#define _RDT_TRANSPORT_H_
+
+#include "rdt_struct.h"
+
+
+/* a packet of "Size" bytes, struct packet is the one of the simulator */
+template <int Size>
+struct basic_packet {
+    char data[Size];
+};
+
+#endif  /* _RDT_TRANSPORT_H_ */
@@ -0,0 +1,380 @@
+/*
+ * FILE: rdt_udp.cc
+ * DESCRIPTION: Runs the reliable data transfer sender or receiver over a UDP
+ *              socket in real time, e.g. through rdt_proxy.  The sender
+ *              sends its standard input, the receiver writes what it
+ *              receives to its standard output, each from a thread of its
+ *              own with -q.  The protocol runs over udp_transport (see
+ *              rdt_udp_transport.h), in the quiet configuration or with -w
+ *              the wide one (see rdt_utils.h).
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <atomic>
+
+#include "rdt_struct.h"
+#include "rdt_utils.h"
+#include "rdt_basic_sender.h"
+#include "rdt_basic_receiver.h"
+#include "rdt_udp_transport.h"
+
+
+static udp_endpoint udp;
+
+static volatile sig_atomic_t stopped = 0;
+
+static void on_signal(int)
+{
+    stopped = 1;
+}
+
+/* the writer thread of recv -q: "data" wakes it when messages are queued,
+   it wakes the receiver through "space" when the window needs announcing.
+   the reader thread of send -q wakes the sender through "data" when it 
+   submitted messages, the sender wakes it through "space" when it drained
+   them. */
+static int data_fd = -1, space_fd = -1;
+static std::atomic<bool> writer_done(false), reader_done(false);
+
+static void kick(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one))<0 && errno!=EAGAIN) {
+	fprintf(stderr, "cannot write eventfd: %s\n", strerror(errno));
+	exit(-1);
+    }
+}
+
+static void drain(int fd)
+{
+    uint64_t count;
+    if (read(fd, &count, sizeof(count))<0 && errno!=EAGAIN) {
+	fprintf(stderr, "cannot read eventfd: %s\n", strerror(errno));
+	exit(-1);
+    }
+}
+
+static simtick_t monotonic_ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (simtick_t) ts.tv_sec*SIM_TICKS_PER_SEC + ts.tv_nsec;
+}
+
+/* time since the start, the clock of the protocol */
+static simtick_t now()
+{
+    return monotonic_ticks()-udp.origin;
+}
+
+/* wait for the socket, the second descriptor if "in" is set, or the sender timer,
+   whichever comes first.  returns false if interrupted by a signal. */
+static bool wait_events(struct pollfd *fds, bool in)
+{
+    struct timespec ts, *tsp = NULL;
+    if (udp.deadline>=0) {
+	simtick_t wait = udp.deadline-now();
+	if (wait<0) wait = 0;
+	ts.tv_sec = wait/SIM_TICKS_PER_SEC;
+	ts.tv_nsec = wait%SIM_TICKS_PER_SEC;
+	tsp = &ts;
+    }
+    if (ppoll(fds, in ? 2 : 1, tsp, NULL)<0) {
+	if (errno==EINTR) return false;
+	fprintf(stderr, "poll failed: %s\n", strerror(errno));
+	exit(-1);
+    }
+    return true;
+}
+
+/* read standard input and submit it to the sender until the end of it,
+   waiting for a drain whenever the submission pool is full */
+template <class Sender>
+static void run_reader(Sender *s)
+{
+    static char buf[4096];
+    struct pollfd fds[1];
+    fds[0].fd = space_fd;
+    fds[0].events = POLLIN;
+
+    /* signals are for the sender loop */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+	int len = read(STDIN_FILENO, buf, sizeof(buf));
+	if (len<=0) break;
+	struct message msg = {len, buf};
+	int ret;
+	while ((ret = s->Submit(&msg))<0) {
+	    if (poll(fds, 1, -1)>0)
+		drain(space_fd);
+	}
+	if (ret) kick(data_fd);
+    }
+    reader_done.store(true);
+    kick(data_fd);
+}
+
+template <class Config>
+static int run_sender(bool queued)
+{
+    typedef udp_transport<Config> transport;
+    typedef typename transport::packet_type packet_type;
+    typedef basic_rdt_sender<Config, transport> sender_type;
+    static char buf[4096];
+    struct pollfd fds[2];
+    fds[0].fd = udp.fd;
+    fds[1].fd = queued ? data_fd : STDIN_FILENO;
+    fds[0].events = fds[1].events = POLLIN;
+    bool eof = false;
+    std::thread reader;
+
+    sender_type *sender = new sender_type(transport(&udp));
+    sender->Init();
+    if (queued) reader = std::thread(run_reader<sender_type>, sender);
+    while (!stopped && !(eof && sender->Idle())) {
+	/* standard input is only read while less than a largest window waits
+	   to be sent, acks and timeouts drain the rest */
+	bool in = !eof && sender->Pending()<(size_t) Config::window_max;
+	fds[1].revents = 0;
+	if (!wait_events(fds, in)) continue;
+
+	if (fds[0].revents & (POLLIN|POLLERR)) {
+	    packet_type pkt;
+	    while (recv(udp.fd, pkt.data, sizeof(pkt), MSG_DONTWAIT)==(ssize_t) sizeof(pkt))
+		sender->FromLowerLayer(&pkt);
+	}
+	if (!eof && queued && (fds[1].revents & POLLIN)) {
+	    /* whatever the reader submitted before it finished is drained
+	       now.  the reader may wait for room, wake it once per batch */
+	    bool done = reader_done.load();
+	    drain(data_fd);
+	    if (sender->Drain()>0) kick(space_fd);
+	    eof = done;
+	} else if (!eof && (fds[1].revents & (POLLIN|POLLHUP))) {
+	    int len = read(STDIN_FILENO, buf, sizeof(buf));
+	    if (len<=0) {
+		eof = true;
+	    } else {
+		struct message msg = {len, buf};
+		sender->FromUpperLayer(&msg);
+	    }
+	}
+	if (udp.deadline>=0 && now()>=udp.deadline) {
+	    udp.deadline = -1;
+	    sender->Timeout();
+	}
+    }
+    sender->Final();
+    if (queued && !reader_done.load()) {
+	/* stopped by a signal, the reader may still block on its input and
+	   then submit, leave it the sender until the process exits */
+	reader.detach();
+	return 0;
+    }
+    if (queued) reader.join();
+    delete sender;
+    return 0;
+}
+
+/* take the messages the receiver queued and write them out until the
+   receiver is done */
+template <class Receiver>
+static void run_writer(Receiver *r)
+{
+    struct pollfd fds[1];
+    fds[0].fd = data_fd;
+    fds[0].events = POLLIN;
+    struct message msg;
+
+    /* signals are for the receiver loop */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+	while (r->Peek(&msg)) {
+	    fwrite(msg.data, 1, msg.size, udp.out);
+	    if (r->Consumed()) kick(space_fd);
+	}
+	fflush(udp.out);
+	if (writer_done.load() && !r->Peek(&msg))
+	    break;
+	if (poll(fds, 1, -1)>0)
+	    drain(data_fd);
+    }
+}
+
+template <class Config>
+static int run_receiver(double idle, bool queued)
+{
+    typedef udp_transport<Config> transport;
+    typedef typename transport::packet_type packet_type;
+    typedef basic_rdt_receiver<Config, transport> receiver_type;
+    struct pollfd fds[2];
+    fds[0].fd = udp.fd;
+    fds[1].fd = space_fd;
+    fds[0].events = fds[1].events = POLLIN;
+    simtick_t last = -1;
+    std::thread writer;
+
+    receiver_type *receiver = new receiver_type(transport(&udp));
+    if (queued) receiver->SetDeliveryQueue(true);
+    receiver->Init();
+    if (queued) writer = std::thread(run_writer<receiver_type>, receiver);
+    while (!stopped) {
+	/* the receiver has no timer, the idle limit borrows the sender's */
+	if (idle>0)
+	    udp.deadline = last<0 ? -1 : last+(simtick_t)(idle*SIM_TICKS_PER_SEC);
+	if (!wait_events(fds, queued)) continue;
+	if (udp.deadline>=0 && now()>=udp.deadline)
+	    break;
+	if (queued && (fds[1].revents & POLLIN)) {
+	    drain(space_fd);
+	    receiver->Reclaim();
+	}
+
+	packet_type pkt;
+	udp.peer_len = sizeof(udp.peer);
+	while (recvfrom(udp.fd, pkt.data, sizeof(pkt), MSG_DONTWAIT,
+			(struct sockaddr*) &udp.peer, &udp.peer_len)==(ssize_t) sizeof(pkt)) {
+	    receiver->FromLowerLayer(&pkt);
+	    last = now();
+	    udp.peer_len = sizeof(udp.peer);
+	}
+	if (queued)
+	    kick(data_fd);
+	else
+	    fflush(udp.out);
+    }
+    receiver->Final();
+    if (queued) {
+	writer_done.store(true);
+	kick(data_fd);
+	writer.join();
+	receiver->Reclaim();
+    }
+    fflush(udp.out);
+    delete receiver;
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s send [-q] [-w] <peer_host> <peer_port>\n"
+	    "       %s recv [-i <idle_time>] [-q] [-w] <listen_port>\n", prog, prog);
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc<2) usage(argv[0]);
+    bool sender = strcmp(argv[1], "send")==0;
+    if (!sender && strcmp(argv[1], "recv")!=0) usage(argv[0]);
+
+    double idle = 0;
+    bool queued = false, wide = false;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "i:qw"))!=-1) {
+	switch (opt) {
+	case 'i':
+	    idle = atof(optarg);
+	    if (idle<0) {
+		fprintf(stderr, "invalid <idle_time>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'q':
+	    queued = true;
+	    break;
+	case 'w':
+	    /* both ends must agree on it */
+	    wide = true;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (argc-optind!=(sender ? 2 : 1)) usage(argv[0]);
+    if (queued) {
+	data_fd = eventfd(0, EFD_NONBLOCK);
+	space_fd = eventfd(0, EFD_NONBLOCK);
+	if (data_fd<0 || space_fd<0) {
+	    fprintf(stderr, "cannot create eventfd: %s\n", strerror(errno));
+	    exit(-1);
+	}
+    }
+
+    udp.origin = monotonic_ticks();
+    udp.deadline = -1;
+    udp.out = stdout;
+
+    if (sender) {
+	/* talk to the peer from an ephemeral port */
+	const char *host = argv[optind], *port = argv[optind+1];
+	struct addrinfo hints, *ai;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	int err = getaddrinfo(host, port, &hints, &ai);
+	if (err!=0) {
+	    fprintf(stderr, "cannot resolve %s:%s: %s\n", host, port, gai_strerror(err));
+	    exit(-1);
+	}
+	udp.fd = socket(ai->ai_family, SOCK_DGRAM, 0);
+	if (udp.fd<0) {
+	    fprintf(stderr, "cannot create socket: %s\n", strerror(errno));
+	    exit(-1);
+	}
+	memcpy(&udp.peer, ai->ai_addr, ai->ai_addrlen);
+	udp.peer_len = ai->ai_addrlen;
+	freeaddrinfo(ai);
+    } else {
+	/* replies go to whoever sent last */
+	int port = atoi(argv[optind]);
+	struct sockaddr_in6 local;
+	memset(&local, 0, sizeof(local));
+	local.sin6_family = AF_INET6;
+	local.sin6_addr = in6addr_any;
+	local.sin6_port = htons(port);
+	udp.fd = socket(AF_INET6, SOCK_DGRAM, 0);
+	int off = 0;
+	setsockopt(udp.fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+	if (udp.fd<0 || bind(udp.fd, (struct sockaddr*) &local, sizeof(local))<0) {
+	    fprintf(stderr, "cannot listen on port %d: %s\n", port, strerror(errno));
+	    exit(-1);
+	}
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (sender)
+	return wide ? run_sender<rdt_wide_config>(queued) : run_sender<rdt_quiet_config>(queued);
+    return wide ? run_receiver<rdt_wide_config>(idle, queued) :
+	run_receiver<rdt_quiet_config>(idle, queued);
+}
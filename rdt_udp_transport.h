@@ -0,0 +1,64 @@
+/*
+ * FILE: rdt_udp_transport.h
+ * DESCRIPTION: Transport of the reliable data transfer sender and receiver
+ *              over a UDP socket (see rdt_transport.h).
+ */
+
+#ifndef _RDT_UDP_TRANSPORT_H_
+#define _RDT_UDP_TRANSPORT_H_
+
+#include <time.h>
+#include <stdio.h>
+#include <vector>
+#include <sys/socket.h>
+
+#include "rdt_struct.h"
+#include "rdt_transport.h"
+
+
+/* a UDP socket driven by the event loop of rdt_udp.cc, which owns this
+   state.  every packet is one datagram to the peer. */
+struct udp_endpoint {
+    int fd;
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    simtick_t origin;           // monotonic time at start
+    simtick_t deadline;         // expiry of the sender timer, -1 if stopped
+    FILE *out;                  // where delivered messages go
+};
+
+template <class Config>
+struct udp_transport {
+    typedef basic_packet<Config::packet_size> packet_type;
+
+    udp_endpoint *ep;
+    std::vector<packet_type *> pool;    // free packet buffers
+
+    explicit udp_transport(udp_endpoint *ep): ep(ep) {}
+
+    simtick_t now() const {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (simtick_t)ts.tv_sec * SIM_TICKS_PER_SEC + ts.tv_nsec - ep->origin;
+    }
+    packet_type *acquire() {
+        if (pool.empty()) return new packet_type;
+        packet_type *pkt = pool.back();
+        pool.pop_back();
+        return pkt;
+    }
+    void release(packet_type *pkt) { pool.push_back(pkt); }
+    void sender_send(packet_type *pkt) {
+        // a datagram that can't be sent counts as lost on the link
+        sendto(ep->fd, pkt->data, sizeof(packet_type), 0,
+               (struct sockaddr *)&ep->peer, ep->peer_len);
+    }
+    void sender_send_buffer(packet_type *pkt) { sender_send(pkt); release(pkt); }
+    void start_timer(simtick_t timeout) { ep->deadline = now() + timeout; }
+    void stop_timer() { ep->deadline = -1; }
+    bool timer_set() const { return ep->deadline >= 0; }
+    void receiver_send_buffer(packet_type *pkt) { sender_send_buffer(pkt); }
+    void deliver(message *msg) { fwrite(msg->data, 1, msg->size, ep->out); }
+};
+
+#endif  /* _RDT_UDP_TRANSPORT_H_ */
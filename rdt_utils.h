@@ -1,36 +1,19 @@
 /*
  * Defines debug info utilities, checksum library and packet format.
  */
+#ifndef _RDT_UTILS_H_
+#define _RDT_UTILS_H_
+
 #include <cstdint>
+#include <cstdio>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
 
 #include "rdt_struct.h"
 
-// output macros
-#define SENDER_INFO(format, ...) \
-    fprintf(stdout, "[%.2fs][INFO][ sender ]", GetSimulationTime());\
-    fprintf(stdout, format "\n", ##__VA_ARGS__);
-
-#define SENDER_WARNING(format, ...) \
-    fprintf(stdout, "[%.2fs][WARN][ sender ]", GetSimulationTime());\
-    fprintf(stdout, format "\n", ##__VA_ARGS__);
-
-#define SENDER_ERROR(format, ...) \
-    fprintf(stderr, "[%.2fs][EROR][ sender ]", GetSimulationTime());\
-    fprintf(stderr, format "\n", ##__VA_ARGS__);
-
-#define RECEIVER_INFO(format, ...) \
-    fprintf(stdout, "[%.2fs][INFO][receiver]", GetSimulationTime());\
-    fprintf(stdout, format "\n", ##__VA_ARGS__);
-    
-#define RECEIVER_WARNING(format, ...) \
-    fprintf(stdout, "[%.2fs][WARN][receiver]", GetSimulationTime());\
-    fprintf(stdout, format "\n", ##__VA_ARGS__);
-
-#define RECEIVER_ERROR(format, ...) \
-    fprintf(stderr, "[%.2fs][EROR][receiver]", GetSimulationTime());\
-    fprintf(stderr, format "\n", ##__VA_ARGS__);
-
 // CRC16 checksum library
 // CRC16-ccitt (the one used in redis) is used here.
 // Generator function of which is: x**16 + x**12 + x**5 + 1
@@ -39,61 +22,207 @@ class CRC16 {
 private:
     static const uint16_t crc16tab[];
 public:
+    // identifies the check in the handshake, see rdt_params
+    static constexpr uint8_t integrity = 1;
     static uint16_t calc(const char *buf, int len, uint16_t crc = 0);
     static bool check(const char *buf, int len);
 };
 
+// logging policies: which of the output macros below print anything.  
+// errors always do.
+struct log_verbose {
+    static constexpr bool info = true, warning = true;
+};
+struct log_quiet {
+    static constexpr bool info = false, warning = false;
+};
+
+/*
+ * Protocol configuration
+ *
+ * The constants of a deployment are members of a configuration type.  The
+ * packet format, the sender (rdt_basic_sender.h) and the receiver 
+ * (rdt_basic_receiver.h) are templates on it, so several configurations can
+ * live in one binary; the simulator's is picked with RDT_CONFIG (see 
+ * rdt_sim_transport.h).  A configuration may derive from rdt_default_config
+ * and override members:
+ * 
+ * seq_type: unsigned type of the sequence numbers on the wire
+ * packet_size: bytes per packet
+ * buffer_slots: packets the sender's ring buffer and the receiver's 
+ *     reordering buffer hold, a power of 2 from 64 up to the sequence space
+ * window_initial, window_max: receive window at the start and at most
+ * sender_timeout, nak_timeout: retransmission timeouts, in ticks
+ * checksum: the check, calc() over a buffer and its handshake id
+ * logging: which output macros print, see log_verbose
+ */
+struct rdt_default_config {
+    typedef uint8_t seq_type;
+    static constexpr int packet_size = RDT_PKTSIZE;
+    static constexpr int buffer_slots = 256;
+    static constexpr int window_initial = 8;
+    static constexpr int window_max = 64;
+    static constexpr simtick_t sender_timeout = SIM_TICKS_PER_SEC;        // 1s
+    static constexpr simtick_t nak_timeout = SIM_TICKS_PER_SEC * 3 / 10;  // 300ms
+    typedef CRC16 checksum;
+    typedef log_verbose logging;
+};
+
+// only errors are printed, the traces fold away
+struct rdt_quiet_config : rdt_default_config {
+    typedef log_quiet logging;
+};
+
+// 16-bit sequence numbers and 1 KiB packets, for paths whose bandwidth-delay
+// product a window of 64 small packets can't fill
+struct rdt_wide_config : rdt_quiet_config {
+    typedef uint16_t seq_type;
+    static constexpr int packet_size = 1024;
+    static constexpr int buffer_slots = 1024;
+    static constexpr int window_initial = 16;
+    static constexpr int window_max = 512;
+};
+
+// output macros, for the sender and receiver templates: they expect the 
+// configuration as Config and the transport as lower
+#define SENDER_INFO(format, ...) do { if(Config::logging::info) { \
+    fprintf(stdout, "[%.2fs][INFO][ sender ]", (double)lower.now() / SIM_TICKS_PER_SEC);\
+    fprintf(stdout, format "\n", ##__VA_ARGS__); } } while(0)
+
+#define SENDER_WARNING(format, ...) do { if(Config::logging::warning) { \
+    fprintf(stdout, "[%.2fs][WARN][ sender ]", (double)lower.now() / SIM_TICKS_PER_SEC);\
+    fprintf(stdout, format "\n", ##__VA_ARGS__); } } while(0)
+
+#define SENDER_ERROR(format, ...) do { \
+    fprintf(stderr, "[%.2fs][EROR][ sender ]", (double)lower.now() / SIM_TICKS_PER_SEC);\
+    fprintf(stderr, format "\n", ##__VA_ARGS__); } while(0)
+
+#define RECEIVER_INFO(format, ...) do { if(Config::logging::info) { \
+    fprintf(stdout, "[%.2fs][INFO][receiver]", (double)lower.now() / SIM_TICKS_PER_SEC);\
+    fprintf(stdout, format "\n", ##__VA_ARGS__); } } while(0)
+    
+#define RECEIVER_WARNING(format, ...) do { if(Config::logging::warning) { \
+    fprintf(stdout, "[%.2fs][WARN][receiver]", (double)lower.now() / SIM_TICKS_PER_SEC);\
+    fprintf(stdout, format "\n", ##__VA_ARGS__); } } while(0)
+
+#define RECEIVER_ERROR(format, ...) do { \
+    fprintf(stderr, "[%.2fs][EROR][receiver]", (double)lower.now() / SIM_TICKS_PER_SEC);\
+    fprintf(stderr, format "\n", ##__VA_ARGS__); } while(0)
+
 /* the internal packet structure of rdt protocol. */
 /*
- * packet format:
- * |  1  |  1  |  1  |  1  |  2  |       the rest(len)       |
- * | ack | seq | len | flg | chk |          payload          |
+ * packet format, with the default configuration:
+ * |  1  |  1  |  1  |  1  |  2  |   len   |   ...   |   4   |   4   |
+ * | seq | ack | len | flg | chk | payload | padding | tsval | tsecr |
+ *                                                   \___ TS option ___/
  * 
- * ack: Acknowledge number, indicating receiver's sliding window start.
  * seq: Current packet's sequence number.
+ * ack: Acknowledge number, indicating receiver's sliding window start.
  * len: Length of the payload.
- * flg: Flags. Currently only the LSB is used to indicate ACK or NAK.
- *      In buffer implementations higher bits in this field can be used to
- *      log useful states, but these higher bits **must** be set to zero
- *      when it's checksumed.
+ * flg: Flags, these bits go on the wire:
+ *      0x01 NAK   set in a NAK, clear in an ACK (and in data packets)
+ *      0x10 TS    the packet carries the timestamp option
+ *      0x20 PUSH  asks the receiver to acknowledge a data packet right away
+ *      0x40 SYN   a handshake packet, its payload holds the parameters
+ *      In buffer implementations the other bits (ACKED 0x02, RECEIVED 0x04,
+ *      NAKING 0x08) can be used to log useful states, but they **must** be
+ *      set to zero when it's checksumed.
  * chk: Checksum of the whole packet(excluding checksum itself) with CRC16.
  * 
+ * seq and ack take the size of the configuration's seq_type, len two bytes
+ * if the payload may exceed 255; chk is aligned to two bytes, a padding byte
+ * in front of it isn't checked.
+ * 
  * In a unidirectional protocol:
  * * Sender can only set the seq number. Ack number doesn't mean anything.
- * * Receiver can only set the ack number. Seq number doesn't mean anything.
+ * * Receiver can only set the ack number. Seq number of an ACK or NAK carries
+ *   the receive window, the number of packets from the window start on the
+ *   receiver can take.
+ * 
+ * The payload of an ACK or NAK is a SACK map of the packets the receiver holds
+ * beyond its window start: bit i (LSB first) is set iff window start + 1 + i
+ * was received, where window start is ack + 1 for an ACK and ack for a NAK.
+ * len is 0 when nothing is held.  A NAK puts the list of holes it asks for
+ * in front of the map: one byte with the number of holes n, then n pairs of
+ * the first and the last missing sequence number, each a seq_type.
+ * 
+ * Handshake: the sender's SYN offers its parameters, the receiver's SYN 
+ * answers with those agreed on, its seq the receive window and its ack the
+ * window start - 1.  The payload is a basic_rdt_params, with the default
+ * configuration (wider fields are aligned as in the struct):
+ * |    1    |     1      |  1  |     1     |    1     |  1  |     1      |
+ * | version | max_window | mtu | integrity | ack_freq | fec | timestamps |
+ * version: RDT_VERSION.
+ * max_window: Largest receive window, in packets, as wide as seq.
+ * mtu: Payload bytes per packet, as wide as len.
+ * integrity: The check, 1 for CRC16.
+ * ack_freq: Acknowledge every n-th in-order packet.
+ * fec: Forward error correction scheme, 0 for none.
+ * timestamps: 1 to carry the timestamp option.
+ * 
+ * Timestamp option: once both ends agreed on it in the handshake, the last 8
+ * bytes of every packet hold two 32-bit microsecond timestamps, tsval (the
+ * sending time) and tsecr (the tsval echoed back), and TS is set.  The 
+ * payload must end before them.  The receiver echoes the tsval of the packet
+ * a reply answers, or of the first packet acknowledged by a delayed ACK.
  * 
  * All other fields are compulsory. Note that even if some values doesn't have
- * meaning, they will be checksumed anyway.
+ * meaning, they will be checksumed anyway.  Multi-byte fields are in host
+ * byte order.
  */
 
-typedef uint8_t seqn_t;
+template <class Config>
+struct basic_rdt_message {
+    typedef typename Config::seq_type seqn_t;
+    typedef typename std::conditional<(Config::packet_size > 256),
+        uint16_t, uint8_t>::type len_type;
 
-constexpr int RDT_HEADER_SIZE = 6;
-constexpr int RDT_PAYLOAD_MAXSIZE = RDT_PKTSIZE - RDT_HEADER_SIZE;
+    // header bytes the checksum covers, and the header with the checksum
+    static constexpr int CHECKED_HEADER_SIZE = 2 * sizeof(seqn_t) + sizeof(len_type) + 1;
+    static constexpr int HEADER_SIZE = (CHECKED_HEADER_SIZE + 1) / 2 * 2 + sizeof(uint16_t);
+    static constexpr int PAYLOAD_MAXSIZE = Config::packet_size - HEADER_SIZE;
+
+    static_assert(std::is_unsigned<seqn_t>::value, "sequence numbers wrap around");
+    static_assert(PAYLOAD_MAXSIZE > 0 &&
+        PAYLOAD_MAXSIZE <= std::numeric_limits<len_type>::max());
+    static_assert(Config::buffer_slots >= 64 &&
+        (Config::buffer_slots & (Config::buffer_slots - 1)) == 0 &&
+        Config::buffer_slots - 1 <= std::numeric_limits<seqn_t>::max(),
+        "buffers are indexed by sequence number, a word of the SACK map at a time");
+    static_assert((Config::window_initial & (Config::window_initial - 1)) == 0);
+    static_assert(Config::window_max >= Config::window_initial &&
+        Config::window_max <= Config::buffer_slots / 2,
+        "a window fits twice into the buffers, and so into half the sequence space");
 
-struct rdt_message {
     seqn_t seq;
     seqn_t ack;
-    uint8_t len;
+    len_type len;
     uint8_t flags;
     uint16_t checksum;
-    char payload[RDT_PAYLOAD_MAXSIZE];
+    char payload[PAYLOAD_MAXSIZE];
 
     static constexpr uint8_t ACK = 0, NAK = 1;
-    // higher bits are for checking in internal buffers
+    static constexpr uint8_t TS = 0x10, PUSH = 0x20, SYN = 0x40;
+    static constexpr uint8_t WIRE_FLAGS = NAK | TS | PUSH | SYN;
+    // the timestamp option takes the end of the payload area
+    static constexpr int TS_OPTION_SIZE = 8;
+    static constexpr int TS_OFFSET = PAYLOAD_MAXSIZE - TS_OPTION_SIZE;
+    // other bits are for checking in internal buffers
     // checksum shouldn't be calculated when these bits are set
     static constexpr uint8_t ACKED = 2;
     static constexpr uint8_t RECEIVED = 4;
     static constexpr uint8_t NAKING = 8;
 
-    rdt_message(): len(0), flags(0) {}
+    basic_rdt_message(): len(0), flags(0) {}
 
     inline uint16_t get_checksum() {
-        assert(len <= RDT_PAYLOAD_MAXSIZE);
-        assert((flags & 0xFE) == 0);
-        constexpr int real_header_size = RDT_HEADER_SIZE - sizeof(uint16_t);
-        uint16_t crc = CRC16::calc((const char *)this, real_header_size);
-        crc = CRC16::calc(this->payload, this->len, crc);
+        assert(len <= PAYLOAD_MAXSIZE);
+        assert((flags & ~WIRE_FLAGS) == 0);
+        typedef typename Config::checksum check_type;
+        uint16_t crc = check_type::calc((const char *)this, CHECKED_HEADER_SIZE);
+        crc = check_type::calc(this->payload, this->len, crc);
+        if(flags & TS)
+            crc = check_type::calc(this->payload + TS_OFFSET, TS_OPTION_SIZE, crc);
         return crc;
     }
 
@@ -102,11 +231,55 @@ struct rdt_message {
         this->checksum = get_checksum();
     }
 
+    // whether a reply is a NAK, other flags may come with it
+    inline bool is_nak() const { return flags & NAK; }
+
+    // offset of the SACK map in the payload of an ACK or NAK, a NAK lists
+    // its holes first
+    inline int sack_offset() const {
+        if(!is_nak() || len == 0) return 0;
+        int off = 1 + 2 * sizeof(seqn_t) * (uint8_t)payload[0];
+        return off < len ? off : len;
+    }
+
+    // entry "i" of the hole list of a NAK, 2n for the first and 2n + 1 for 
+    // the last missing packet of hole n
+    inline seqn_t hole(int i) const {
+        seqn_t s;
+        memcpy(&s, payload + 1 + i * sizeof(seqn_t), sizeof(s));
+        return s;
+    }
+
+    inline void set_hole(int i, seqn_t s) {
+        memcpy(payload + 1 + i * sizeof(seqn_t), &s, sizeof(s));
+    }
+
+    // add the timestamp option, host byte order like the checksum
+    inline void set_timestamps(uint32_t val, uint32_t ecr) {
+        flags |= TS;
+        memcpy(payload + TS_OFFSET, &val, sizeof(val));
+        memcpy(payload + TS_OFFSET + sizeof(val), &ecr, sizeof(ecr));
+    }
+
+    inline uint32_t ts_val() const {
+        uint32_t v;
+        memcpy(&v, payload + TS_OFFSET, sizeof(v));
+        return v;
+    }
+
+    inline uint32_t ts_ecr() const {
+        uint32_t v;
+        memcpy(&v, payload + TS_OFFSET + sizeof(v), sizeof(v));
+        return v;
+    }
+
     // check if the packet is corrupted.
     inline bool check() {
-        if(len > RDT_PAYLOAD_MAXSIZE)
+        if(len > PAYLOAD_MAXSIZE)
+            return false;
+        if((flags & TS) && len > TS_OFFSET)
             return false;
-        if((this->flags & 0xFE) != 0)
+        if((this->flags & ~WIRE_FLAGS) != 0)
             return false;
         uint16_t s = get_checksum();
         if(this->checksum != s)
@@ -115,23 +288,102 @@ struct rdt_message {
     }
 };
 
-// make sure that internal packet and low level packet are of the same size
-static_assert(sizeof(rdt_message) == sizeof(packet));
-
-// shared parameters
-const seqn_t MAX_SEQ = 255;
-const seqn_t WINDOW_SIZE = 8;
-const double SENDER_TIMEOUT = 1;
-const double NAK_TIMEOUT = 0.3;
-
-// make sure MAX_SEQ is 2**n - 1 and WINDOW_SIZE is 2**n
-static_assert((int(MAX_SEQ) & (int(MAX_SEQ) + 1)) == 0);
-static_assert((WINDOW_SIZE & (WINDOW_SIZE - 1)) == 0);
-
-// helper functions to calculate sequence numbers
-inline void inc(seqn_t &s) { ++s; s &= MAX_SEQ; }
-inline seqn_t add(seqn_t a, seqn_t b) { return (a + b) & MAX_SEQ; }
-inline seqn_t minus(seqn_t a, seqn_t b) { return (a - b) & MAX_SEQ; }
-inline bool lt(seqn_t a, seqn_t b) { return (int8_t)(a - b) < 0; }
-inline bool lte(seqn_t a, seqn_t b) { return (int8_t)(a - b) <= 0; }
-inline bool between(seqn_t a, seqn_t b, seqn_t c) { return (lt(a,b) || a==b) && lt(b,c); }
+// the default format fills the simulator's packets exactly
+static_assert(sizeof(basic_rdt_message<rdt_default_config>) == sizeof(packet));
+
+/*
+ * Transport parameters
+ *
+ * Before any data flows, the sender offers its parameters in the payload of a
+ * SYN packet.  The receiver answers with a SYN carrying the agreed values,
+ * each the smaller of the offer and its own limit, and the sender uses those
+ * from then on.  A SYN that goes unanswered is repeated after SENDER_TIMEOUT.
+ */
+template <class Config>
+struct basic_rdt_params {
+    typedef basic_rdt_message<Config> message_type;
+
+    uint8_t version;
+    typename message_type::seqn_t max_window;   // largest receive window, in packets
+    typename message_type::len_type mtu;        // payload bytes per packet
+    uint8_t integrity;      // INTEGRITY_*
+    uint8_t ack_freq;       // acknowledge every n-th in-order packet
+    uint8_t fec;            // forward error correction scheme, 0 for none
+    uint8_t timestamps;     // 1 to carry the timestamp option
+};
+
+constexpr uint8_t RDT_VERSION = 1;
+// only CRC16 is implemented, the field leaves room for other checks
+constexpr uint8_t INTEGRITY_CRC16 = CRC16::integrity;
+
+// helper functions to calculate sequence numbers, of any unsigned type
+template <class T>
+inline void inc(T &s) { ++s; }
+template <class T>
+inline T add(T a, int b) { return T(a + b); }
+template <class T>
+inline T minus(T a, int b) { return T(a - b); }
+template <class T>
+inline bool lt(T a, T b) { return (typename std::make_signed<T>::type)(a - b) < 0; }
+template <class T>
+inline bool lte(T a, T b) { return (typename std::make_signed<T>::type)(a - b) <= 0; }
+template <class T>
+inline bool between(T a, T b, T c) { return (lt(a,b) || a==b) && lt(b,c); }
+
+// an array of "N" entries indexed by sequence number, wrapping around.  N is
+// a power of 2 no larger than the sequence space, so as long as the numbers 
+// in use span less than N they have entries of their own.
+template <class T, int N>
+struct seq_array {
+    static_assert((N & (N - 1)) == 0);
+    T at[N];
+
+    inline T &operator[](unsigned seq) { return at[seq & (N - 1)]; }
+    inline const T &operator[](unsigned seq) const { return at[seq & (N - 1)]; }
+    inline void fill(const T &v) { std::fill(at, at + N, v); }
+};
+
+// timestamps of the timestamp option, microseconds wrapping at 32 bits
+inline uint32_t to_timestamp(simtick_t t) { return (uint32_t)(t / 1000); }
+// ticks from timestamp "b" to timestamp "a"
+inline simtick_t ts_diff(uint32_t a, uint32_t b) { return (simtick_t)(int32_t)(a - b) * 1000; }
+
+// the parameters an end point supports by default
+template <class Config>
+inline basic_rdt_params<Config> default_params() {
+    basic_rdt_params<Config> p = {};
+    p.version = RDT_VERSION;
+    p.max_window = Config::window_max;
+    p.mtu = basic_rdt_message<Config>::PAYLOAD_MAXSIZE;
+    p.integrity = Config::checksum::integrity;
+    p.ack_freq = 1;
+    return p;
+}
+
+// settle an offer against the limits of the receiving end
+template <class Config>
+inline basic_rdt_params<Config> negotiate(const basic_rdt_params<Config> &offer,
+                                          const basic_rdt_params<Config> &limit) {
+    typedef basic_rdt_params<Config> params;
+    params p = {};
+    p.version = std::min(offer.version, limit.version);
+    p.max_window = std::max<decltype(p.max_window)>(1, std::min(offer.max_window, limit.max_window));
+    p.mtu = std::max<decltype(p.mtu)>(1, std::min(offer.mtu, limit.mtu));
+    p.integrity = Config::checksum::integrity;
+    p.ack_freq = std::max<uint8_t>(1, std::min(offer.ack_freq, limit.ack_freq));
+    p.fec = offer.fec == limit.fec ? offer.fec : 0;
+    p.timestamps = std::min(offer.timestamps, limit.timestamps);
+    if(p.timestamps)
+        p.mtu = std::min<decltype(p.mtu)>(p.mtu, params::message_type::TS_OFFSET);
+    return p;
+}
+
+// helpers for binary state snapshots (see Sender_Save/Receiver_Save)
+// values are written in host layout, snapshots are only meant to be read back
+// by the same build.
+template <typename T>
+inline bool snap_write(FILE *fp, const T &v) { return fwrite(&v, sizeof(T), 1, fp) == 1; }
+template <typename T>
+inline bool snap_read(FILE *fp, T &v) { return fread(&v, sizeof(T), 1, fp) == 1; }
+
+#endif  /* _RDT_UTILS_H_ */